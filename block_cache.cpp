@@ -0,0 +1,70 @@
+#include "block_cache.h"
+#include "log.h"
+
+const int BlockCache::NO_BLOCK;
+const uint BlockCache::MAX_BLOCK_LENGTH;
+
+bool BlockCache::cacheable(u16 pc) {
+    if (pc < 0x8000) return true;                   // ROM
+    if (pc >= 0xC000 && pc < 0xE000) return true;   // WRAM
+    if (pc >= 0xFF80 && pc < 0xFFFF) return true;   // HRAM
+    return false;
+}
+
+int* BlockCache::slot(u16 pc, uint bank) {
+    if (pc < 0x4000) {
+        if (rom_bank0.empty()) rom_bank0.assign(BANK_SIZE, NO_BLOCK);
+        return &rom_bank0[pc];
+    }
+    if (pc < 0x8000) {
+        if (bank >= rom_banks.size()) rom_banks.resize(bank + 1);
+        auto& table = rom_banks[bank];
+        if (table.empty()) table.assign(BANK_SIZE, NO_BLOCK);
+        return &table[pc - 0x4000];
+    }
+
+    // WRAM and HRAM share one table indexed from 0x8000
+    if (ram.empty()) ram.assign(0x8000, NO_BLOCK);
+    return &ram[pc - 0x8000];
+}
+
+int BlockCache::lookup(u16 pc, uint bank) const {
+    if (pc < 0x4000) {
+        return rom_bank0.empty() ? NO_BLOCK : rom_bank0[pc];
+    }
+    if (pc < 0x8000) {
+        if (bank >= rom_banks.size() || rom_banks[bank].empty()) return NO_BLOCK;
+        return rom_banks[bank][pc - 0x4000];
+    }
+    return ram.empty() ? NO_BLOCK : ram[pc - 0x8000];
+}
+
+int BlockCache::insert(u16 pc, uint bank, const std::vector<DecodedInstruction>& code) {
+    if (decoded.size() + code.size() > MAX_INSTRUCTIONS) {
+        log_debug("Block cache full (%u instructions), flushing", (uint)decoded.size());
+        flush();
+    }
+
+    Block b;
+    b.first = static_cast<uint>(decoded.size());
+    b.count = static_cast<uint>(code.size());
+    decoded.insert(decoded.end(), code.begin(), code.end());
+
+    int id = static_cast<int>(blocks.size());
+    blocks.push_back(b);
+    *slot(pc, bank) = id;
+    return id;
+}
+
+// RAM blocks are only unlinked; their instructions are reclaimed on the next full flush
+void BlockCache::flush_ram() {
+    if (!ram.empty()) ram.assign(ram.size(), NO_BLOCK);
+}
+
+void BlockCache::flush() {
+    blocks.clear();
+    decoded.clear();
+    rom_bank0.clear();
+    rom_banks.clear();
+    ram.clear();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include "definitions.h"
+
+class CPU;
+
+using opcode_handler_t = void (CPU::*)();
+using jit_block_t = void (*)(CPU* cpu);
+
+/*
+    One pre-decoded instruction. The handler is the same opcode_XX
+    method the interpreter dispatches to; its immediates are taken
+    from imm instead of being fetched through the MMU.
+*/
+struct DecodedInstruction {
+    opcode_handler_t handler;
+    u16 next_pc;
+    u8 opcode;      // 0xCB for prefixed instructions, with the second byte in imm[0]
+    u8 imm[2];
+    u8 cycles;      // clock cycles
+    u8 cycles_branched;
+};
+
+struct Block {
+    uint first;  // index of the first instruction
+    uint count;
+    uint hits = 0;               // interpreted runs, for the JIT's hotness check
+    jit_block_t native = nullptr;
+    bool verifiable = false;
+};
+
+/*
+    Basic blocks keyed by (ROM bank, PC). ROM code can only change
+    through bank switching, which is part of the key; code in RAM is
+    dropped wholesale as soon as anything writes to a page holding it.
+*/
+class BlockCache {
+public:
+    static const int NO_BLOCK = -1;
+    static const uint MAX_BLOCK_LENGTH = 32;
+
+    // Whether code at this address may be cached at all (ROM, WRAM, HRAM)
+    static bool cacheable(u16 pc);
+
+    int lookup(u16 pc, uint bank) const;
+    int insert(u16 pc, uint bank, const std::vector<DecodedInstruction>& code);
+
+    Block& block(int id) { return blocks[id]; }
+    const Block& block(int id) const { return blocks[id]; }
+    const DecodedInstruction* instructions(const Block& b) const { return &decoded[b.first]; }
+
+    void flush_ram();
+    void flush();
+
+private:
+    static const uint BANK_SIZE = 0x4000;
+    static const uint MAX_INSTRUCTIONS = 1 << 20;
+
+    int* slot(u16 pc, uint bank);
+
+    std::vector<Block> blocks;
+    std::vector<DecodedInstruction> decoded;
+
+    // Block id per address; switchable ROM banks are allocated lazily
+    std::vector<int> rom_bank0;
+    std::vector<std::vector<int>> rom_banks;
+    std::vector<int> ram;
+};
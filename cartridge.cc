@@ -5,6 +5,8 @@
 #include "log.h"
 #include "address.h"
 
+#include <algorithm>
+
 std::shared_ptr<Cartridge> get_cartridge(const std::vector<u8>& rom_data,
 										 const std::vector<u8>& ram_data) {
 	// Parse cartinfo
@@ -18,11 +20,15 @@ std::shared_ptr<Cartridge> get_cartridge(const std::vector<u8>& rom_data,
 			return std::make_shared<NoMBC>(rom_data, ram_data, std::move(info));
 		case CartridgeType::MBC1:
 			return std::make_shared<MBC1>(rom_data, ram_data, std::move(info));
+		case CartridgeType::MBC2:
+			return std::make_shared<MBC2>(rom_data, ram_data, std::move(info));
 		case CartridgeType::MBC3:
 			return std::make_shared<MBC3>(rom_data, ram_data, std::move(info));
+		case CartridgeType::MBC5:
+			return std::make_shared<MBC5>(rom_data, ram_data, std::move(info));
 		default:
-			log_error("Cartridge type &d not implemented, defaulting to NoMBC", int(info->type));
-			return std::make_shared<NoMBC>(rom_data, ram_data, nullptr);
+			log_error("Cartridge type %s not implemented, defaulting to NoMBC", describe(info->type).c_str());
+			return std::make_shared<NoMBC>(rom_data, ram_data, std::move(info));
 	}
 }
 
@@ -33,15 +39,74 @@ Cartridge::Cartridge(std::vector<u8> rom_data,
 	, ram(std::move(ram_data))
 	, cartridge_info(std::move(info)) {
 
+	// Pad to whole banks (at least two) so mapped banks never need a bounds check
+	size_t banks = (rom.size() + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+	if (banks < 2) banks = 2;
+	rom.resize(banks * ROM_BANK_SIZE, 0xFF);
+	rom_bank_count = static_cast<uint>(banks);
+
+	map_rom(0, 0);
+	map_rom(1, 1);
+
+	// Size RAM from the header; a larger save file is kept as is
+	const size_t ram_size = get_actual_ram_size(cartridge_info->ram_size);
+	if (ram.size() < ram_size) ram.resize(ram_size, 0xFF);
+
 	log_info("Created Cartridge base: title=%s, type=%s",
 			 cartridge_info->title.c_str(),
 			 describe(cartridge_info->type).c_str());
 }
 
-const std::vector<u8>& Cartridge::get_cartridge_ram() const {
+const CartridgeRam& Cartridge::get_cartridge_ram() const {
 	return ram;
 }
 
+std::vector<u8> Cartridge::get_save_data() const {
+	std::vector<u8> data = ram.contents();
+	append_save_trailer(data);
+	return data;
+}
+
+bool Cartridge::map_save_file(const std::string& path) {
+	std::vector<u8> trailer;
+	append_save_trailer(trailer);
+
+	// The mapped bank moves with the storage
+	const size_t bank_offset = ram_map ? size_t(ram_map - ram.data()) : 0;
+	const bool bank_mapped = ram_map != nullptr;
+
+	if (!ram.map_file(path, trailer.size())) return false;
+
+	std::copy(trailer.begin(), trailer.end(), ram.trailer());
+	ram_map = bank_mapped ? ram.data() + bank_offset : nullptr;
+	return true;
+}
+
+void Cartridge::sync_save(bool wait) {
+	if (!ram.mapped()) return;
+
+	std::vector<u8> trailer;
+	append_save_trailer(trailer);
+	std::copy(trailer.begin(), trailer.end(), ram.trailer());
+	ram.sync(wait);
+}
+
+void Cartridge::map_rom(uint slot, uint bank) {
+	bank %= rom_bank_count;
+	mapped_bank[slot] = bank;
+	rom_map[slot] = rom.data() + bank * ROM_BANK_SIZE;
+}
+
+void Cartridge::map_ram(bool enabled, uint bank) {
+	const size_t offset = size_t(bank) * RAM_BANK_SIZE;
+	if (enabled && offset + RAM_BANK_SIZE <= ram.size()) {
+		ram_map = ram.data() + offset;
+	}
+	else {
+		ram_map = nullptr;
+	}
+}
+
 NoMBC::NoMBC(std::vector<u8> rom_data,
 			 std::vector<u8> ram_data,
 			 std::unique_ptr<CartridgeInfo> info)
@@ -52,11 +117,7 @@ u8 NoMBC::read(const Address& address) const {
 
 	// 0x0000..0x7FFF => ROM
 	if (addr < 0x8000) {
-		if (addr < rom.size()) {
-			return rom[addr];
-		}
-		// If out of range for some reason, returns 0xFF
-		return 0xFF;
+		return read_rom(addr);
 	}
 	// 0xA000..0xBFFF => external cartridge RAM
 	else if (addr >= 0xA000 && addr < 0xC000) {
@@ -77,28 +138,30 @@ MBC1::MBC1(std::vector<u8> rom_data,
 		   std::unique_ptr<CartridgeInfo> info)
 	: Cartridge(std::move(rom_data), std::move(ram_data), std::move(info)) {
 
-	current_rom_bank = 1;
+	bank_low = 1;
+	bank_high = 0;
 	current_ram_bank = 0;
 	ram_enabled = false;
 	banking_mode_select = false;
+	update_banks();
+}
+
+/*
+	The 2-bit register is the upper ROM bank bits in mode 0; in mode 1
+	it also selects the RAM bank and the bank seen at 0x0000..0x3FFF.
+*/
+void MBC1::update_banks() {
+	map_rom(1, (bank_high << 5) | bank_low);
+	map_rom(0, banking_mode_select ? (bank_high << 5) : 0);
+	current_ram_bank = banking_mode_select ? bank_high : 0;
+	map_ram(ram_enabled, current_ram_bank);
 }
 
 u8 MBC1::read(const Address& address) const {
 	u16 addr = address.value();
 
-	if (addr < 0x4000) {
-		return (addr < rom.size()) ? rom[addr] : 0xFF;
-	}
-	else if (addr < 0x8000) {
-		size_t bank_offset = (current_rom_bank - 1) * 0x4000;
-		size_t offset_in_bank = (addr - 0x4000);
-		size_t final_addr = bank_offset + offset_in_bank;
-
-		if (final_addr < rom.size()) {
-			return rom[final_addr];
-		}
-
-		return 0xFF;
+	if (addr < 0x8000) {
+		return read_rom(addr);
 	}
 	else if (addr >= 0xA000 && addr < 0xC000) {
 		if (!ram_enabled || ram.empty()) {
@@ -124,39 +187,24 @@ void MBC1::write(const Address& address, u8 value) {
 	// Enable/disable RAM => 0x0000..0x1FFF
 	if (addr < 0x2000) {
 		ram_enabled = ((value & 0x0F) == 0x0A);
+		map_ram(ram_enabled, current_ram_bank);
 	}
 	// ROM Bank select => 0x2000..0x3FFF
 	else if (addr < 0x4000) {
-		int bank_val = (value & 0x1F);
-		if (bank_val == 0) bank_val = 1;
-
-		current_rom_bank = (current_rom_bank & 0x60) | bank_val;  // 0x60 = bits 5 and 6
-		if (current_rom_bank == 0) {
-			current_rom_bank = 1;
-		}
+		bank_low = (value & 0x1F);
+		if (bank_low == 0) bank_low = 1;
+		update_banks();
 	}
 	// Upper ROM bank bits or RAM bank select => 0x4000..0x5FFF
 	else if (addr < 0x6000) {
-		int bank_val = (value & 0x03); // only 2 bits used
-		if (!banking_mode_select) {
-			int upper_bits = (bank_val << 5);
-			int lower_five = (current_rom_bank & 0x1F);
-			current_rom_bank = lower_five | upper_bits;
-			if ((current_rom_bank & 0x1F) == 0) {
-				current_rom_bank = (current_rom_bank & 0xE0) | 1;
-			}
-		}
-		else {
-			// In RAM banking mode, these 2 bits select the RAM bank
-			current_ram_bank = bank_val;
-		}
+		bank_high = (value & 0x03); // only 2 bits used
+		update_banks();
 	}
 	// Banking mode select => 0x6000..0x7FFF
 	else if (addr < 0x8000) {
 		// 0 => ROM banking mode, 1 => RAM banking mode
 		banking_mode_select = (value & 0x01);
-		if (!banking_mode_select) {
-		}
+		update_banks();
 	}
 	// Cartridge RAM => 0xA000..0xBFFF
 	else if (addr >= 0xA000 && addr < 0xC000) {
@@ -166,6 +214,7 @@ void MBC1::write(const Address& address, u8 value) {
 			size_t final_addr = ram_bank_offset + offset;
 			if (final_addr < ram.size()) {
 				ram[final_addr] = value;
+				ram_dirty = true;
 			}
 		}
 	}
@@ -175,22 +224,28 @@ MBC3::MBC3(std::vector<u8> rom_data,
 		   std::vector<u8> ram_data,
 		   std::unique_ptr<CartridgeInfo> info)
 	: Cartridge(std::move(rom_data), std::move(ram_data), std::move(info)) {
-	current_rom_bank = 1;
 	current_ram_bank = 0;
 	ram_enabled = false;
 	using_rtc = false;
+	has_clock = cartridge_info->rtc;
+
+	// Save files from timer carts end in the RTC block
+	const size_t ram_size = get_actual_ram_size(cartridge_info->ram_size);
+	const size_t extra = ram.size() - std::min(ram.size(), ram_size);
+	if (has_clock && (extra == RealTimeClock::SAVE_SIZE || extra == RealTimeClock::SAVE_SIZE_SHORT)) {
+		clock.load(ram.data() + ram_size, extra);
+		ram.resize(ram_size);
+	}
+}
+
+void MBC3::append_save_trailer(std::vector<u8>& out) const {
+	if (has_clock) clock.save(out);
 }
 
 u8 MBC3::read(const Address& address) const {
 	u16 addr = address.value();
-	if (addr < 0x4000) {
-		return (addr < rom.size()) ? rom[addr] : 0xFF;
-	}
-	else if (addr < 0x8000) {
-		size_t bank_offset = (current_rom_bank - 1) * 0x4000;
-		size_t offset_in_bank = addr - 0x4000;
-		size_t final_addr = bank_offset + offset_in_bank;
-		return (final_addr < rom.size()) ? rom[final_addr] : 0xFF;
+	if (addr < 0x8000) {
+		return read_rom(addr);
 	}
 	else if (addr >= 0xA000 && addr < 0xC000) {
 		// Cartridge RAM or RTC register
@@ -205,7 +260,7 @@ u8 MBC3::read(const Address& address) const {
 			return (final_addr < ram.size()) ? ram[final_addr] : 0xFF;
 		}
 		else {
-			return 0;
+			return clock.read(rtc_register);
 		}
 	}
 	return 0xFF;
@@ -217,12 +272,13 @@ void MBC3::write(const Address& address, u8 value) {
 	if (addr < 0x2000) {
 		// Enable/disable RAM
 		ram_enabled = ((value & 0x0F) == 0x0A);
+		map_ram(ram_enabled && !using_rtc, current_ram_bank);
 	}
 	else if (addr < 0x4000) {
 		// ROM bank select (7 bits, 0 => 1)
 		int bank_val = (value & 0x7F);
 		if (bank_val == 0) bank_val = 1;
-		current_rom_bank = bank_val;
+		map_rom(1, bank_val);
 	}
 	else if (addr < 0x6000) {
 		// RAM bank or RTC select
@@ -235,10 +291,16 @@ void MBC3::write(const Address& address, u8 value) {
 		else if (bank_val >= 0x08 && bank_val <= 0x0C) {
 			// RTC registers
 			using_rtc = true;
+			rtc_register = bank_val;
 		}
+		map_ram(ram_enabled && !using_rtc, current_ram_bank);
 	}
 	else if (addr < 0x8000) {
-		// 0x6000..0x7FFF => Latch clock data, etc. (if implemented)
+		// 0x6000..0x7FFF => Latch clock data
+		if (last_latch_write == 0x00 && value == 0x01) {
+			clock.latch();
+		}
+		last_latch_write = value;
 	}
 	else if (addr >= 0xA000 && addr < 0xC000) {
 		// Write to RAM or RTC
@@ -251,9 +313,132 @@ void MBC3::write(const Address& address, u8 value) {
 			size_t final_addr = ram_bank_offset + offset;
 			if (final_addr < ram.size()) {
 				ram[final_addr] = value;
+				ram_dirty = true;
 			}
 		}
 		else {
+			clock.write(rtc_register, value);
+			ram_dirty = true;
 		}
 	}
-}
\ No newline at end of file
+}
+
+MBC2::MBC2(std::vector<u8> rom_data,
+		   std::vector<u8> ram_data,
+		   std::unique_ptr<CartridgeInfo> info)
+	: Cartridge(std::move(rom_data), std::move(ram_data), std::move(info)) {
+	// The header reports no RAM; the 512 nibbles are inside the MBC
+	if (ram.size() < RAM_SIZE) ram.resize(RAM_SIZE, 0xFF);
+}
+
+u8 MBC2::read(const Address& address) const {
+	u16 addr = address.value();
+
+	if (addr < 0x8000) {
+		return read_rom(addr);
+	}
+	else if (addr >= 0xA000 && addr < 0xC000) {
+		if (!ram_enabled) return 0xFF;
+		// Only the low nibble exists, the upper bits read as set
+		return 0xF0 | ram[addr & (RAM_SIZE - 1)];
+	}
+	return 0xFF;
+}
+
+void MBC2::write(const Address& address, u8 value) {
+	u16 addr = address.value();
+
+	// Address bit 8 selects between RAM enable (clear) and ROM bank (set)
+	if (addr < 0x4000) {
+		if (addr & 0x0100) {
+			uint bank = value & 0x0F;
+			if (bank == 0) bank = 1;
+			map_rom(1, bank);
+		}
+		else {
+			ram_enabled = ((value & 0x0F) == 0x0A);
+		}
+	}
+	else if (addr >= 0xA000 && addr < 0xC000) {
+		if (ram_enabled) {
+			ram[addr & (RAM_SIZE - 1)] = value & 0x0F;
+			ram_dirty = true;
+		}
+	}
+}
+
+MBC5::MBC5(std::vector<u8> rom_data,
+		   std::vector<u8> ram_data,
+		   std::unique_ptr<CartridgeInfo> info)
+	: Cartridge(std::move(rom_data), std::move(ram_data), std::move(info)) {
+	has_rumble = cartridge_info->rumble;
+	update_banks();
+}
+
+// Unlike MBC1/3, bank 0 can be mapped at 0x4000..0x7FFF
+void MBC5::update_banks() {
+	map_rom(1, (rom_bank_high << 8) | rom_bank_low);
+	map_ram(ram_enabled, current_ram_bank);
+}
+
+u8 MBC5::read(const Address& address) const {
+	u16 addr = address.value();
+
+	if (addr < 0x8000) {
+		return read_rom(addr);
+	}
+	// RAM reads only get here while it is disabled or smaller than a full bank
+	else if (addr >= 0xA000 && addr < 0xC000) {
+		if (!ram_enabled || ram.empty()) {
+			return 0xFF;
+		}
+		size_t final_addr = current_ram_bank * 0x2000 + (addr - 0xA000);
+
+		if (final_addr < ram.size()) {
+			return ram[final_addr];
+		}
+	}
+
+	return 0xFF;
+}
+
+void MBC5::write(const Address& address, u8 value) {
+	u16 addr = address.value();
+
+	// Enable/disable RAM => 0x0000..0x1FFF
+	if (addr < 0x2000) {
+		ram_enabled = ((value & 0x0F) == 0x0A);
+		map_ram(ram_enabled, current_ram_bank);
+	}
+	// Low 8 ROM bank bits => 0x2000..0x2FFF
+	else if (addr < 0x3000) {
+		rom_bank_low = value;
+		update_banks();
+	}
+	// ROM bank bit 8 => 0x3000..0x3FFF
+	else if (addr < 0x4000) {
+		rom_bank_high = value & 0x01;
+		update_banks();
+	}
+	// RAM bank select => 0x4000..0x5FFF
+	else if (addr < 0x6000) {
+		if (has_rumble) {
+			rumble_on = (value & 0x08) != 0;
+			current_ram_bank = value & 0x07;
+		}
+		else {
+			current_ram_bank = value & 0x0F;
+		}
+		map_ram(ram_enabled, current_ram_bank);
+	}
+	// Cartridge RAM smaller than a full bank => 0xA000..0xBFFF
+	else if (addr >= 0xA000 && addr < 0xC000) {
+		if (ram_enabled && !ram.empty()) {
+			size_t final_addr = current_ram_bank * 0x2000 + (addr - 0xA000);
+			if (final_addr < ram.size()) {
+				ram[final_addr] = value;
+				ram_dirty = true;
+			}
+		}
+	}
+}
@@ -8,6 +8,8 @@
 #include "definitions.h"
 #include "address.h"
 #include "register.h"
+#include "rtc.h"
+#include "cartridge_ram.h"
 
 class Cartridge {
 public:
@@ -19,12 +21,91 @@ public:
 	virtual u8 read(const Address& address) const = 0;
 	virtual void write(const Address& address, u8 value) = 0;
 
-	const std::vector<u8>& get_cartridge_ram() const;
+	/*
+		ROM reads are the hot path and are not virtual: every mapper
+		keeps rom_map pointing at the banks it has mapped, refreshed
+		only when a bank register is written.
+	*/
+	u8 read_rom(u16 addr) const { return rom_map[addr >> 14][addr & 0x3FFF]; }
+
+	/*
+		External RAM works the same way while a mapper has a full 8KB
+		bank enabled; disabled RAM, RAM smaller than a bank, RTC registers
+		and MBC2's nibble RAM leave ram_map null and go through the
+		virtual read/write, which every mapper must handle.
+	*/
+	u8 read_ram(u16 addr) const {
+		return ram_map ? ram_map[addr - 0xA000] : read(Address(addr));
+	}
+	void write_ram(u16 addr, u8 value) {
+		if (ram_map) {
+			ram_map[addr - 0xA000] = value;
+			ram_dirty = true;
+		}
+		else write(Address(addr), value);
+	}
+
+	// Direct pointers for bulk reads (OAM DMA), which never cross a page.
+	// mapped_ram is null where read_ram goes through the mapper.
+	const u8* mapped_rom(u16 addr) const { return rom_map[addr >> 14] + (addr & 0x3FFF); }
+	const u8* mapped_ram(u16 addr) const { return ram_map ? ram_map + (addr - 0xA000) : nullptr; }
+
+	// Banks mapped at 0x0000..0x3FFF and 0x4000..0x7FFF
+	uint low_rom_bank() const { return mapped_bank[0]; }
+	uint rom_bank() const { return mapped_bank[1]; }
+
+	const CartridgeRam& get_cartridge_ram() const;
+	// What goes in the battery save: RAM plus any mapper state such as the RTC
+	std::vector<u8> get_save_data() const;
+
+	/*
+		Alternative to writing get_save_data() out: RAM lives in a shared
+		mapping of the save file and sync_save() refreshes the trailer
+		and starts (or with `wait`, finishes) writeback.
+	*/
+	bool map_save_file(const std::string& path);
+	bool save_mapped() const { return ram.mapped(); }
+	void sync_save(bool wait);
+
+	// The cartridge's clock, if it has one
+	virtual RealTimeClock* rtc() { return nullptr; }
+
+	bool has_battery() const { return cartridge_info->battery; }
+
+	// Whether RAM may have changed since the last call
+	bool take_ram_dirty() {
+		const bool dirty = ram_dirty;
+		ram_dirty = false;
+		return dirty;
+	}
+	const std::string& title() const { return cartridge_info->title; }
 
 protected:
+	static const uint ROM_BANK_SIZE = 0x4000;
+
+	// Maps `bank` (wrapped to the ROM size) into slot 0 (0x0000) or 1 (0x4000)
+	void map_rom(uint slot, uint bank);
+
+	static const uint RAM_BANK_SIZE = 0x2000;
+
+	// Maps RAM `bank` at 0xA000, or unmaps it when disabled or out of range
+	void map_ram(bool enabled, uint bank);
+
+	// Mapper state saved after the RAM
+	virtual void append_save_trailer(std::vector<u8>& out) const { unused(out); }
+
 	std::vector<u8> rom;
-	std::vector<u8> ram;
+	CartridgeRam ram;
 	std::unique_ptr<CartridgeInfo> cartridge_info;
+	// Set only when a byte of save data is stored, so writes to disabled
+	// RAM don't cause a background save
+	bool ram_dirty = false;
+
+private:
+	const u8* rom_map[2];
+	u8* ram_map = nullptr;
+	uint mapped_bank[2];
+	uint rom_bank_count;
 };
 
 /*
@@ -53,7 +134,10 @@ public:
 	u8 read(const Address& address) const override;
 	void write(const Address& address, u8 value) override;
 private:
-	int current_rom_bank = 1;
+	void update_banks();
+
+	int bank_low = 1;	// 5-bit register at 0x2000
+	int bank_high = 0;	// 2-bit register at 0x4000
 	int current_ram_bank = 0;
 	bool ram_enabled = false;
 	
@@ -69,11 +153,59 @@ public:
 
 	u8 read(const Address& address) const override;
 	void write(const Address& address, u8 value) override;
+
+	RealTimeClock* rtc() override { return has_clock ? &clock : nullptr; }
 private:
-	int current_rom_bank = 1;
 	int current_ram_bank = 0;
 	bool ram_enabled = false;
 
 	// MBC3 can also map RTC registers instead of RAM banks
 	bool using_rtc = false;
-};
\ No newline at end of file
+	u8 rtc_register = 0;
+
+	RealTimeClock clock;
+	bool has_clock = false;
+
+	void append_save_trailer(std::vector<u8>& out) const override;
+	// Latching takes a 0x00 then 0x01 write to 0x6000..0x7FFF
+	u8 last_latch_write = 0xFF;
+};
+
+class MBC2 : public Cartridge {
+public:
+	MBC2(std::vector<u8> rom_data,
+		 std::vector<u8> ram_data,
+		 std::unique_ptr<CartridgeInfo> info);
+
+	u8 read(const Address& address) const override;
+	void write(const Address& address, u8 value) override;
+private:
+	// Built-in 512 x 4-bit RAM, mirrored across 0xA000..0xBFFF
+	static const uint RAM_SIZE = 0x200;
+
+	bool ram_enabled = false;
+};
+
+class MBC5 : public Cartridge {
+public:
+	MBC5(std::vector<u8> rom_data,
+		 std::vector<u8> ram_data,
+		 std::unique_ptr<CartridgeInfo> info);
+
+	u8 read(const Address& address) const override;
+	void write(const Address& address, u8 value) override;
+
+	// Motor state on rumble cartridges, for the frontend to forward
+	bool rumble_active() const { return rumble_on; }
+private:
+	void update_banks();
+
+	uint rom_bank_low = 1;	// 8-bit register at 0x2000
+	uint rom_bank_high = 0;	// 1-bit register at 0x3000
+	uint current_ram_bank = 0;
+	bool ram_enabled = false;
+
+	// Rumble carts use bit 3 of the RAM bank register for the motor
+	bool has_rumble = false;
+	bool rumble_on = false;
+};
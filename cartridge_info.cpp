@@ -1,7 +1,7 @@
 #include "cartridge_info.h"
 #include "log.h"
 
-std::unique_ptr<CartridgeInfo> get_info(std::vector<u8> rom) {
+std::unique_ptr<CartridgeInfo> get_info(const std::vector<u8>& rom) {
     std::unique_ptr<CartridgeInfo> info = std::make_unique<CartridgeInfo>();
 
     u8 type_code     = rom[header::cartridge_type];
@@ -10,10 +10,17 @@ std::unique_ptr<CartridgeInfo> get_info(std::vector<u8> rom) {
     u8 ram_size_code = rom[header::ram_size];
 
     info->type       = get_type(type_code);
+    info->rumble     = has_rumble(type_code);
+    info->rtc        = has_rtc(type_code);
+    info->battery    = has_battery(type_code);
     info->version    = version_code;
     info->rom_size   = get_rom_size(rom_size_code);
     info->ram_size   = get_ram_size(ram_size_code);
     info->title      = get_title(rom);
+    info->supports_cgb = (rom[header::cgb_flag] & 0x80) != 0;
+    info->supports_sgb = rom[header::sgb_flag] == 0x03;
+    info->header_checksum = rom[header::header_checksum];
+    info->global_checksum = (rom[header::global_checksum] << 8) | rom[header::global_checksum + 1];
 
     log_info("Title:      '%s' (version %d)", info->title.c_str(), info->version);
     log_info("Cartridge:  %s", describe(info->type).c_str());
@@ -23,6 +30,23 @@ std::unique_ptr<CartridgeInfo> get_info(std::vector<u8> rom) {
     return info;
 }
 
+u8 compute_header_checksum(const std::vector<u8>& rom) {
+    u8 x = 0;
+    for (int i = header::title; i < header::header_checksum; i++) {
+        x = x - rom[i] - 1;
+    }
+    return x;
+}
+
+u16 compute_global_checksum(const std::vector<u8>& rom) {
+    u16 sum = 0;
+    for (size_t i = 0; i < rom.size(); i++) {
+        if (i == header::global_checksum || i == header::global_checksum + 1) continue;
+        sum += rom[i];
+    }
+    return sum;
+}
+
 CartridgeType get_type(u8 type) {
     switch (type) {
         case 0x00:
@@ -90,6 +114,23 @@ std::string describe(CartridgeType type) {
     return "Unknown";
 }
 
+bool has_rumble(u8 type) {
+    return type >= 0x1C && type <= 0x1E;
+}
+
+bool has_rtc(u8 type) {
+    return type == 0x0F || type == 0x10;
+}
+
+bool has_battery(u8 type) {
+    switch (type) {
+        case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F: case 0x10:
+        case 0x13: case 0x17: case 0x1B: case 0x1E: case 0x22: case 0xFF:
+            return true;
+    }
+    return false;
+}
+
 // ROM sizes
 ROMSize get_rom_size(u8 size_code) {
     switch (size_code) {
@@ -101,6 +142,7 @@ ROMSize get_rom_size(u8 size_code) {
         case 0x05: return ROMSize::MB1;
         case 0x06: return ROMSize::MB2;
         case 0x07: return ROMSize::MB4;
+        case 0x08: return ROMSize::MB8;
         case 0x52: return ROMSize::MB1p1;
         case 0x53: return ROMSize::MB1p2;
         case 0x54: return ROMSize::MB1p5;
@@ -119,6 +161,7 @@ std::string describe(ROMSize size) {
         case ROMSize::MB1:   return "1MB";
         case ROMSize::MB2:   return "2MB";
         case ROMSize::MB4:   return "4MB";
+        case ROMSize::MB8:   return "8MB";
         case ROMSize::MB1p1: return "1.1MB";
         case ROMSize::MB1p2: return "1.2MB";
         case ROMSize::MB1p5: return "1.5MB";
@@ -181,14 +224,16 @@ std::string describe(Destination destination) {
     }
 }
 
-std::string get_title(std::vector<u8>& rom) {
+std::string get_title(const std::vector<u8>& rom) {
     char name[TITLE_LENGTH] = {0};
 
     for (u8 i = 0; i < TITLE_LENGTH; i++) {
         name[i] = static_cast<char>(rom[header::title + i]);
     }
 
-    std::string raw(name);
+    // The title fills all 11 bytes when it has no terminator
+    std::string raw(name, TITLE_LENGTH);
+    raw = raw.substr(0, raw.find('\0'));
     while (!raw.empty() && (raw.back() == ' ' || raw.back() == '\0'))
         raw.pop_back();
     return raw;
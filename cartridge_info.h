@@ -40,7 +40,16 @@ enum class CartridgeType {
 CartridgeType get_type(u8 type);
 std::string describe(CartridgeType type);
 
-std::string get_title(std::vector<u8>& rom);
+// Whether the type code is one of the MBC5 + rumble motor variants
+bool has_rumble(u8 type);
+
+// Whether the type code is one of the MBC3 + timer variants
+bool has_rtc(u8 type);
+
+// Whether the cartridge keeps its RAM (and clock) powered when off
+bool has_battery(u8 type);
+
+std::string get_title(const std::vector<u8>& rom);
 
 std::string get_license(u16 old_license, u16 new_license);
 
@@ -54,6 +63,7 @@ enum class ROMSize {
 	MB1,
 	MB2,
 	MB4,
+	MB8,
 	MB1p1,
 	MB1p2,
 	MB1p5,
@@ -85,6 +95,9 @@ class CartridgeInfo {
 public:
 	std::string title;
 	CartridgeType type;
+	bool rumble;
+	bool rtc;
+	bool battery;
 	Destination destination;
 	ROMSize rom_size;
 	RAMSize ram_size;
@@ -98,4 +111,9 @@ public:
 	bool supports_sgb;
 };
 
-std::unique_ptr<CartridgeInfo> get_info(std::vector<u8> rom);
\ No newline at end of file
+std::unique_ptr<CartridgeInfo> get_info(const std::vector<u8>& rom);
+
+// Checksum over 0x134..0x14C as the boot ROM computes it
+u8 compute_header_checksum(const std::vector<u8>& rom);
+// 16-bit sum of every byte except the global checksum itself
+u16 compute_global_checksum(const std::vector<u8>& rom);
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "cartridge_ram.h"
+#include "log.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+CartridgeRam::CartridgeRam(std::vector<u8> data)
+	: buffer(std::move(data)) {
+	base = buffer.data();
+	length = buffer.size();
+}
+
+CartridgeRam::~CartridgeRam() {
+	unmap();
+}
+
+void CartridgeRam::resize(size_t size, u8 fill) {
+	if (mapped()) {
+		log_error("Cannot resize mapped cartridge RAM");
+		return;
+	}
+	buffer.resize(size, fill);
+	base = buffer.data();
+	length = buffer.size();
+}
+
+bool CartridgeRam::map_file(const std::string& path, size_t trailer_size) {
+	if (mapped()) return true;
+
+	const size_t size = length + trailer_size;
+	if (size == 0) return false;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+							  nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		log_error("Cannot open %s for mapping", path.c_str());
+		return false;
+	}
+	// The save is exactly RAM + trailer, like ftruncate below
+	LARGE_INTEGER end;
+	end.QuadPart = LONGLONG(size);
+	HANDLE map = nullptr;
+	if (SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file)) {
+		map = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	}
+	void* view = map ? MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+	if (!view) {
+		log_error("Cannot map %s", path.c_str());
+		if (map) CloseHandle(map);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = map;
+#else
+	fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		log_error("Cannot open %s for mapping", path.c_str());
+		return false;
+	}
+	void* view = MAP_FAILED;
+	if (ftruncate(fd, off_t(size)) == 0) {
+		view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (view == MAP_FAILED) {
+		log_error("Cannot map %s", path.c_str());
+		close(fd);
+		fd = -1;
+		return false;
+	}
+#endif
+
+	mapping = static_cast<u8*>(view);
+	mapping_size = size;
+
+	// The buffer was loaded from this file (or freshly filled), so it wins
+	std::copy(base, base + length, mapping);
+	base = mapping;
+	buffer.clear();
+	buffer.shrink_to_fit();
+
+	log_info("Cartridge RAM mapped to %s (%u bytes)", path.c_str(), uint(size));
+	return true;
+}
+
+void CartridgeRam::sync(bool wait) {
+	if (!mapped()) return;
+#ifdef _WIN32
+	FlushViewOfFile(mapping, mapping_size);
+	if (wait) FlushFileBuffers(static_cast<HANDLE>(file_handle));
+#else
+	msync(mapping, mapping_size, wait ? MS_SYNC : MS_ASYNC);
+#endif
+}
+
+void CartridgeRam::unmap() {
+	if (!mapped()) return;
+	sync(true);
+#ifdef _WIN32
+	UnmapViewOfFile(mapping);
+	CloseHandle(static_cast<HANDLE>(mapping_handle));
+	CloseHandle(static_cast<HANDLE>(file_handle));
+#else
+	munmap(mapping, mapping_size);
+	close(fd);
+	fd = -1;
+#endif
+	mapping = nullptr;
+	base = nullptr;
+	length = 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+
+/*
+	Cartridge RAM storage: a plain buffer, or a shared mapping of the
+	save file so writes land straight in the page cache and the OS
+	writes them back. Mappers only see data()/size() either way.
+*/
+class CartridgeRam : Noncopyable {
+public:
+	CartridgeRam() = default;
+	explicit CartridgeRam(std::vector<u8> data);
+	~CartridgeRam();
+
+	u8* data() { return base; }
+	const u8* data() const { return base; }
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+
+	u8& operator[](size_t i) { return base[i]; }
+	const u8& operator[](size_t i) const { return base[i]; }
+
+	// Only valid before the RAM is mapped
+	void resize(size_t size, u8 fill = 0xFF);
+
+	std::vector<u8> contents() const { return std::vector<u8>(base, base + length); }
+
+	/*
+		Moves the contents into a MAP_SHARED mapping of `path`, sized
+		`trailer_size` bytes past the RAM for mapper state such as the
+		RTC. Returns false (still buffered) if the file can't be mapped.
+	*/
+	bool map_file(const std::string& path, size_t trailer_size);
+	bool mapped() const { return mapping != nullptr; }
+
+	// The bytes after the RAM in the mapped file
+	u8* trailer() { return base + length; }
+
+	// Starts writeback of the mapping; `wait` blocks until it is on disk
+	void sync(bool wait);
+
+private:
+	void unmap();
+
+	std::vector<u8> buffer;
+	u8* base = nullptr;
+	size_t length = 0;
+
+	u8* mapping = nullptr;
+	size_t mapping_size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int fd = -1;
+#endif
+};
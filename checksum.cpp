@@ -0,0 +1,114 @@
+#include "checksum.h"
+
+namespace {
+
+// Eight tables so the main loop folds in eight bytes per step
+struct Crc32Tables {
+    uint32_t table[8][256];
+
+    Crc32Tables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int t = 1; t < 8; t++) {
+                table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+const Crc32Tables& crc32_tables() {
+    static const Crc32Tables tables;
+    return tables;
+}
+
+}
+
+uint32_t crc32(const u8* data, size_t size, uint32_t crc) {
+    const auto& t = crc32_tables().table;
+    crc = ~crc;
+
+    while (size >= 8) {
+        const uint32_t lo = crc ^ (uint32_t(data[0]) | uint32_t(data[1]) << 8
+                                 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+            ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+namespace {
+
+uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+void sha1_block(uint32_t h[5], const u8* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16
+             | uint32_t(block[4 * i + 2]) << 8 | uint32_t(block[4 * i + 3]);
+    }
+    for (int i = 16; i < 80; i++) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+        else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+        const uint32_t t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+}
+
+void sha1(const u8* data, size_t size, u8 digest[SHA1_SIZE]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    size_t full = size / 64;
+    for (size_t i = 0; i < full; i++) sha1_block(h, data + 64 * i);
+
+    // Padding: 0x80, zeros, then the bit length big-endian in the last 8 bytes
+    u8 tail[128] = {};
+    const size_t rest = size - 64 * full;
+    for (size_t i = 0; i < rest; i++) tail[i] = data[64 * full + i];
+    tail[rest] = 0x80;
+    const size_t tail_size = rest < 56 ? 64 : 128;
+    const uint64_t bits = uint64_t(size) * 8;
+    for (int i = 0; i < 8; i++) tail[tail_size - 1 - i] = u8(bits >> (8 * i));
+
+    sha1_block(h, tail);
+    if (tail_size == 128) sha1_block(h, tail + 64);
+
+    for (int i = 0; i < 5; i++) {
+        digest[4 * i]     = u8(h[i] >> 24);
+        digest[4 * i + 1] = u8(h[i] >> 16);
+        digest[4 * i + 2] = u8(h[i] >> 8);
+        digest[4 * i + 3] = u8(h[i]);
+    }
+}
+
+uint64_t fnv1a64(const u8* data, size_t size) {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+
+#include "definitions.h"
+
+// CRC-32 (IEEE, as in gzip and zip); pass the previous result to continue a stream
+uint32_t crc32(const u8* data, size_t size, uint32_t crc = 0);
+
+const size_t SHA1_SIZE = 20;
+void sha1(const u8* data, size_t size, u8 digest[SHA1_SIZE]);
+
+// 64-bit FNV-1a, for content-addressed cache keys
+uint64_t fnv1a64(const u8* data, size_t size);
@@ -1,6 +1,19 @@
+#include <cstdlib>
 #include <iostream>
 
 #include "cli.h"
+#include "rom_loader.h"
+
+// rom.gb (or rom.gb.gz) => rom.sav, next to the ROM
+static std::string default_save_file(const std::string& compressed_file) {
+	const std::string rom_file = strip_compression_extension(compressed_file);
+	const size_t dot = rom_file.find_last_of('.');
+	const size_t slash = rom_file.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return rom_file + ".sav";
+	}
+	return rom_file.substr(0, dot) + ".sav";
+}
 
 Options get_options(int argc, char* argv[]) {
 	Options opts;
@@ -9,13 +22,53 @@ Options get_options(int argc, char* argv[]) {
 		exit(1);
 	}
 	opts.filename = argv[1];
+	opts.save_file = default_save_file(opts.filename);
 
 	for (int i = 2; i < argc; i++) {
 		std::string arg = argv[i];
 		if (arg == "--debug") opts.deubgger = true;
 		else if (arg == "--trace") opts.trace = true;
+		else if (arg == "--break" && i + 1 < argc) {
+			opts.deubgger = true;
+			opts.breakpoints.push_back(argv[++i]);
+		}
+		else if (arg == "--watch" && i + 1 < argc) {
+			opts.deubgger = true;
+			opts.watchpoints.push_back(argv[++i]);
+		}
 		else if (arg == "--silent") opts.disable_logs = true;
 		else if (arg == "--exit-on-infinite-jr") opts.exit_on_infinite_jr = true;
+		else if (arg == "--cached") opts.cached_interpreter = true;
+		else if (arg == "--jit") {
+			opts.cached_interpreter = true;
+			opts.jit = true;
+		}
+		else if (arg == "--jit-verify") {
+			opts.cached_interpreter = true;
+			opts.jit = true;
+			opts.jit_verify = true;
+		}
+		else if (arg == "--no-idle-skip") opts.idle_skip = false;
+		else if (arg == "--rtc-emulated") opts.rtc_emulated = true;
+		else if (arg == "--accurate-ppu") opts.accurate_ppu = true;
+		else if (arg == "--render-thread") opts.render_thread = true;
+		else if (arg == "--headless") opts.headless = true;
+		else if (arg == "--frames" && i + 1 < argc) opts.frames = uint(std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--frame-skip" && i + 1 < argc) opts.frame_skip = uint(std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--save" && i + 1 < argc) opts.save_file = argv[++i];
+		else if (arg == "--no-save") opts.save_file.clear();
+		else if (arg == "--save-mmap") opts.save_mmap = true;
+		else if (arg == "--rom-cache" && i + 1 < argc) opts.rom_cache = argv[++i];
+		else if (arg == "--no-rom-cache") opts.rom_cache.clear();
+		else if (arg == "--profile") opts.profile = true;
+		else if (arg == "--profile-csv" && i + 1 < argc) {
+			opts.profile = true;
+			opts.profile_csv = argv[++i];
+		}
+		else if (arg == "--profile-trace" && i + 1 < argc) {
+			opts.profile = true;
+			opts.profile_trace = argv[++i];
+		}
 		else {
 			std::cerr << "Unknown option: " << arg << "\n";
 		}
@@ -1,13 +1,34 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include "definitions.h"
 
 struct Options {
 	bool deubgger = false;
 	bool trace = false;
 	bool disable_logs = false;
 	bool exit_on_infinite_jr = false;
+	bool cached_interpreter = false;
+	bool jit = false;
+	bool jit_verify = false;
+	bool idle_skip = true;
+	bool rtc_emulated = false;
+	uint frame_skip = 0;	// frames left undrawn after each drawn one
+	bool render_thread = false;	// draw lines on a second thread
+	bool accurate_ppu = false;	// pixel FIFO timing for mode 3
+	bool headless = false;	// no window and no rendering, as fast as possible
+	uint frames = 0;		// headless: stop after this many frames, 0 = never
+	bool profile = false;
+	std::string profile_csv;
+	std::string profile_trace;
 	std::string filename;
+	std::string save_file;	// battery save, empty to disable
+	bool save_mmap = false;	// map the save file instead of rewriting it
+	std::string rom_cache = "rom_cache";	// decompressed ROMs, empty to disable
+	std::vector<std::string> breakpoints;	// see Debugger::add_breakpoint
+	std::vector<std::string> watchpoints;	// see Debugger::add_watchpoint
 };
 
 Options get_options(int argc, char* argv[]);
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "log.h"
 #include "mmu.h"
 #include "gameboy.h"
+#include "jit.h"
 
 using bitwise::compose_bytes;
 
@@ -35,20 +36,52 @@ CPU::CPU(Gameboy& inGb, MMU* inMMU, Options& inOptions)
 		h.set(0x01);
 		l.set(0x4D);
 
+		update_pending_interrupts();
+
 		log_debug("CPU constructed: PC=0x%04X, SP=0x%04X", pc.value(), sp.value());
 }
 
+// Out of line so unique_ptr<Jit> sees the complete type
+CPU::~CPU() = default;
+
+bool CPU::State::operator==(const State& o) const {
+	return a == o.a && b == o.b && c == o.c && d == o.d && e == o.e && f == o.f
+		&& h == o.h && l == o.l && sp == o.sp && pc == o.pc
+		&& ime == o.ime && ei_pending == o.ei_pending && halted == o.halted;
+}
+
+CPU::State CPU::state() const {
+	return State{ a.value(), b.value(), c.value(), d.value(), e.value(), f.value(),
+		h.value(), l.value(), sp.value(), pc.value(), interrupts_enabled, ei_pending, halted };
+}
+
+void CPU::restore(const State& s) {
+	a.set(s.a); b.set(s.b); c.set(s.c); d.set(s.d); e.set(s.e); f.set(s.f);
+	h.set(s.h); l.set(s.l); sp.set(s.sp); pc.set(s.pc);
+	interrupts_enabled = s.ime;
+	ei_pending = s.ei_pending;
+	halted = s.halted;
+	update_pending_interrupts();
+}
+
+template <class F>
 Cycles CPU::tick() {
-	handle_interrupts();
-	if (halted) return Cycles(4);
+	if (pending_interrupts) handle_interrupts();
+	if (halted) return Cycles(CLOCKS_PER_M_CYCLE);
+
+	return step<F>();
+}
 
+template <class F>
+Cycles CPU::step() {
 	u16 old_pc = pc.value();
 	u8 opcode = get_byte_from_pc();
-	auto result = execute_opcode(opcode, old_pc);
+	auto result = execute_opcode<F>(opcode, old_pc);
 
 	if (ei_pending) {
 		ei_pending = false;
 		interrupts_enabled = true;
+		update_pending_interrupts();
 	}
 	
 	return result;
@@ -56,30 +89,44 @@ Cycles CPU::tick() {
 
 void CPU::opcode_halt() {
 	halted = true;
+	update_pending_interrupts();
 }
 
+// The trace is the only per-instruction instrumentation; Fast drops it
+template <class F>
 Cycles CPU::execute_opcode(u8 opcode, u16 opcode_pc) {
 	branch_taken = false;
 
 	if (opcode == 0xCB) {
 		u8 cb_opcode = get_byte_from_pc();
-		return execute_cb_opcode(cb_opcode, opcode_pc);
+		if (F::trace) log_trace(" 0x%04X: %s (CB 0x%x)", opcode_pc, opcode_cb_names[cb_opcode].c_str(), cb_opcode);
+		return execute_cb_opcode(cb_opcode);
 	}
-	return execute_normal_opcode(opcode, opcode_pc);
+	if (F::trace) log_trace(" 0x%04X: %s (0x%x)", opcode_pc, opcode_names[opcode].c_str(), opcode);
+	return execute_normal_opcode(opcode);
 }
 
+template Cycles CPU::tick<Features::Fast>();
+template Cycles CPU::tick<Features::Debug>();
+template Cycles CPU::step<Features::Fast>();
+template Cycles CPU::step<Features::Debug>();
+
+// Only called with pending_interrupts set, so something is fired and enabled
 void CPU::handle_interrupts() {
-	u8 fired = interrupt_flag.value() & interrupt_enabled.value();
-	if (!fired) return;
+	u8 fired = pending_interrupts;
 	halted = false;
-	if (!interrupts_enabled) return;
+	if (!interrupts_enabled) {
+		// Woken from HALT with IME off: continue without dispatching
+		update_pending_interrupts();
+		return;
+	}
 
 	stack_push(pc);
-	if (handle_interrupt(0, interrupts::vblank,      fired)) return;
-	if (handle_interrupt(1, interrupts::lcdc_status, fired)) return;
-	if (handle_interrupt(2, interrupts::timer,       fired)) return;
-	if (handle_interrupt(3, interrupts::serial,      fired)) return;
-	if (handle_interrupt(4, interrupts::joypad,      fired)) return;
+	if (handle_interrupt(interrupt_bits::vblank,      interrupts::vblank,      fired)) return;
+	if (handle_interrupt(interrupt_bits::lcdc_status, interrupts::lcdc_status, fired)) return;
+	if (handle_interrupt(interrupt_bits::timer,       interrupts::timer,       fired)) return;
+	if (handle_interrupt(interrupt_bits::serial,      interrupts::serial,      fired)) return;
+	if (handle_interrupt(interrupt_bits::joypad,      interrupts::joypad,      fired)) return;
 }
 
 bool CPU::handle_interrupt(u8 interrupt_bit, u16 vector, u8 fired_interrupts) {
@@ -89,11 +136,35 @@ bool CPU::handle_interrupt(u8 interrupt_bit, u16 vector, u8 fired_interrupts) {
 	interrupt_flag.set_bit_to(interrupt_bit, false);
 	pc.set(vector);
 	interrupts_enabled = false;
+	update_pending_interrupts();
 	return true;
 }
 
+void CPU::update_pending_interrupts() {
+	u8 fired = interrupt_flag.value() & interrupt_enabled.value() & 0x1F;
+	pending_interrupts = (interrupts_enabled || halted) ? fired : 0;
+}
+
+void CPU::request_interrupt(u8 bit) {
+	interrupt_flag.set_bit_to(bit, true);
+	update_pending_interrupts();
+}
+
+void CPU::write_interrupt_flag(u8 value) {
+	interrupt_flag.set(value);
+	update_pending_interrupts();
+}
+
+void CPU::write_interrupt_enable(u8 value) {
+	interrupt_enabled.set(value);
+	update_pending_interrupts();
+}
+
 // Helpers to read from PC
 u8 CPU::get_byte_from_pc() {
+	// Running a decoded block: PC already points past the instruction
+	if (decoded_imm) return *decoded_imm++;
+
 	u8 b = mmu->read(Address(pc.value()));
 	pc.increment();
 	return b;
@@ -144,9 +215,7 @@ void CPU::set_flag_subtract(bool set) { f.set_flag_subtract(set); }
 void CPU::set_flag_half_carry(bool set) { f.set_flag_half_carry(set); }
 void CPU::set_flag_carry(bool set) { f.set_flag_carry(set); }
 
-Cycles CPU::execute_normal_opcode(const u8 opcode, u16 opcode_pc) {
-	log_trace(" 0x%04X: %s (0x%x)", opcode_pc, opcode_names[opcode].c_str(), opcode);
-
+Cycles CPU::execute_normal_opcode(const u8 opcode) {
 	switch (opcode) {
 	case 0x00: opcode_00(); break; case 0x01: opcode_01(); break; case 0x02: opcode_02(); break; case 0x03: opcode_03(); break; case 0x04: opcode_04(); break; case 0x05: opcode_05(); break; case 0x06: opcode_06(); break; case 0x07: opcode_07(); break; case 0x08: opcode_08(); break; case 0x09: opcode_09(); break; case 0x0A: opcode_0A(); break; case 0x0B: opcode_0B(); break; case 0x0C: opcode_0C(); break; case 0x0D: opcode_0D(); break; case 0x0E: opcode_0E(); break; case 0x0F: opcode_0F(); break;
 	case 0x10: opcode_10(); break; case 0x11: opcode_11(); break; case 0x12: opcode_12(); break; case 0x13: opcode_13(); break; case 0x14: opcode_14(); break; case 0x15: opcode_15(); break; case 0x16: opcode_16(); break; case 0x17: opcode_17(); break; case 0x18: opcode_18(); break; case 0x19: opcode_19(); break; case 0x1A: opcode_1A(); break; case 0x1B: opcode_1B(); break; case 0x1C: opcode_1C(); break; case 0x1D: opcode_1D(); break; case 0x1E: opcode_1E(); break; case 0x1F: opcode_1F(); break;
@@ -167,16 +236,14 @@ Cycles CPU::execute_normal_opcode(const u8 opcode, u16 opcode_pc) {
 	}
 
 	if (!branch_taken) {
-		return Cycles(opcode_cycles[opcode]);
+		return Cycles(opcode_cycles[opcode] * CLOCKS_PER_M_CYCLE);
 	}
 	else {
-		return Cycles(opcode_cycles_branched[opcode]);
+		return Cycles(opcode_cycles_branched[opcode] * CLOCKS_PER_M_CYCLE);
 	}
 }
 
-Cycles CPU::execute_cb_opcode(const u8 opcode, u16 opcode_pc) {
-	log_trace(" 0x%04X: %s (CB 0x%x)", opcode_pc, opcode_cb_names[opcode].c_str(), opcode);
-
+Cycles CPU::execute_cb_opcode(const u8 opcode) {
 	switch (opcode) {
 	case 0x00: opcode_CB_00(); break; case 0x01: opcode_CB_01(); break; case 0x02: opcode_CB_02(); break; case 0x03: opcode_CB_03(); break; case 0x04: opcode_CB_04(); break; case 0x05: opcode_CB_05(); break; case 0x06: opcode_CB_06(); break; case 0x07: opcode_CB_07(); break; case 0x08: opcode_CB_08(); break; case 0x09: opcode_CB_09(); break; case 0x0A: opcode_CB_0A(); break; case 0x0B: opcode_CB_0B(); break; case 0x0C: opcode_CB_0C(); break; case 0x0D: opcode_CB_0D(); break; case 0x0E: opcode_CB_0E(); break; case 0x0F: opcode_CB_0F(); break;
 	case 0x10: opcode_CB_10(); break; case 0x11: opcode_CB_11(); break; case 0x12: opcode_CB_12(); break; case 0x13: opcode_CB_13(); break; case 0x14: opcode_CB_14(); break; case 0x15: opcode_CB_15(); break; case 0x16: opcode_CB_16(); break; case 0x17: opcode_CB_17(); break; case 0x18: opcode_CB_18(); break; case 0x19: opcode_CB_19(); break; case 0x1A: opcode_CB_1A(); break; case 0x1B: opcode_CB_1B(); break; case 0x1C: opcode_CB_1C(); break; case 0x1D: opcode_CB_1D(); break; case 0x1E: opcode_CB_1E(); break; case 0x1F: opcode_CB_1F(); break;
@@ -196,7 +263,7 @@ Cycles CPU::execute_cb_opcode(const u8 opcode, u16 opcode_pc) {
 	case 0xF0: opcode_CB_F0(); break; case 0xF1: opcode_CB_F1(); break; case 0xF2: opcode_CB_F2(); break; case 0xF3: opcode_CB_F3(); break; case 0xF4: opcode_CB_F4(); break; case 0xF5: opcode_CB_F5(); break; case 0xF6: opcode_CB_F6(); break; case 0xF7: opcode_CB_F7(); break; case 0xF8: opcode_CB_F8(); break; case 0xF9: opcode_CB_F9(); break; case 0xFA: opcode_CB_FA(); break; case 0xFB: opcode_CB_FB(); break; case 0xFC: opcode_CB_FC(); break; case 0xFD: opcode_CB_FD(); break; case 0xFE: opcode_CB_FE(); break; case 0xFF: opcode_CB_FF(); break;
 	}
 
-	return Cycles(opcode_cycles_cb[opcode]);
+	return Cycles(opcode_cycles_cb[opcode] * CLOCKS_PER_M_CYCLE);
 }
 
 void CPU::opcode_00() { opcode_nop(); }
@@ -1,14 +1,18 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 
 #include "definitions.h"
 #include "register.h"
 #include "cli.h"
 #include "address.h"
+#include "block_cache.h"
+#include "features.h"
 
 class Gameboy;
 class MMU;
+class Jit;
 
 /*
     Enums for conditions like NZ, Z, NC, C
@@ -31,6 +35,14 @@ namespace interrupts {
     const u16 joypad      = 0x60;
 }
 
+namespace interrupt_bits {
+    const u8 vblank      = 0;
+    const u8 lcdc_status = 1;
+    const u8 timer       = 2;
+    const u8 serial      = 3;
+    const u8 joypad      = 4;
+}
+
 namespace rst {
     const u16 rst1 = 0x00;
     const u16 rst2 = 0x08;
@@ -46,27 +58,74 @@ namespace rst {
 class CPU {
 public:
     CPU(Gameboy& inGb, MMU* inMMU, Options& inOptions);
+    ~CPU();
 
     void setMMUPointer(MMU* mmu) { this->mmu = mmu; }
 
-    // Returns how many cycles that opcode used
+    // Returns how many cycles that opcode used. Instantiated for
+    // Features::Fast and Features::Debug.
+    template <class F>
     Cycles tick();
 
+    // Cached-interpreter tick: runs a whole pre-decoded basic block
+    // and returns the cycles of every instruction in it
+    Cycles tick_block();
+    void enable_block_cache();
+
+    // Compiles hot blocks to x86-64 on top of the block cache. With verify,
+    // register-only blocks are also run through the interpreter and compared.
+    void enable_jit(bool verify);
+
+    // Reported by the MMU for writes to pages holding cached code
+    // (including MBC registers, which may switch the decoded bank)
+    void code_write(u16 address);
+
+    // Stops a cached block after the current instruction, for when the
+    // memory it would fetch from changes under it (OAM DMA)
+    void end_block() { block_exit = true; }
+    // Drops every decoded block, e.g. once a breakpoint lands in one
+    void flush_code();
+
+    // Dispatches a pending interrupt now instead of at the start of the
+    // next tick, so the debugger sees the PC that really runs next
+    void dispatch_interrupts() { if (pending_interrupts) handle_interrupts(); }
+    bool is_halted() const { return halted; }
+
+    // Everything an instruction can change outside of memory
+    struct State {
+        u8 a, b, c, d, e, f, h, l;
+        u16 sp, pc;
+        bool ime, ei_pending, halted;
+
+        bool operator==(const State& other) const;
+        bool operator!=(const State& other) const { return !(*this == other); }
+    };
+    State state() const;
+
+    u16 program_counter() const { return pc.value(); }
+
     /*
-        Public registers for interrupt flags.
-        CPU sets or reads bits in these to note which
-        interrupts are fired or enabled
+        Interrupt registers (IF 0xFF0F, IE 0xFFFF). Sources raise
+        requests with request_interrupt; every write goes through
+        here so the cached pending word stays in sync.
     */
-    ByteRegister interrupt_flag;
-    ByteRegister interrupt_enabled;
+    void request_interrupt(u8 bit);
+    u8 read_interrupt_flag() const { return interrupt_flag.value(); }
+    u8 read_interrupt_enable() const { return interrupt_enabled.value(); }
+    void write_interrupt_flag(u8 value);
+    void write_interrupt_enable(u8 value);
 
 private:
     // Core internal methods
+    template <class F>
+    Cycles step();
+    template <class F>
     Cycles execute_opcode(u8 opcode, u16 opcode_pc);
-    Cycles execute_normal_opcode(u8 opcode, u16 opcode_pc);
-    Cycles execute_cb_opcode(u8 opcode, u16 opcode_pc);
+    Cycles execute_normal_opcode(u8 opcode);
+    Cycles execute_cb_opcode(u8 opcode);
 
     void handle_interrupts();
+    void restore(const State& s);
     bool handle_interrupt(u8 interrupt_bit, u16 vector, u8 fired_interrupts);
 
     // CPU registers 8-bit
@@ -87,12 +146,38 @@ private:
     Options& options;
     Gameboy& gb;
 
+    ByteRegister interrupt_flag;
+    ByteRegister interrupt_enabled;
+
+    // IF & IE while IME is set or the CPU is halted, else 0: non-zero
+    // means handle_interrupts has something to do before the next instruction
+    u8 pending_interrupts = 0;
+    void update_pending_interrupts();
+
     // states
     bool interrupts_enabled = false;
     bool ei_pending         = false;
     bool branch_taken       = false;
     bool halted             = false;
 
+    // Block cache state
+    BlockCache block_cache;
+    bool block_exit         = false;
+    const u8* decoded_imm   = nullptr;  // immediates of the running decoded instruction
+
+    int decode_block(u16 start_pc, uint bank);
+    uint run_decoded(const Block& block);
+    uint run_native(Block& block);
+
+    // JIT state
+    friend class Jit;
+    std::unique_ptr<Jit> jit;
+    bool jit_verify         = false;
+    uint jit_cycles         = 0;        // cycles accumulated by the running native block
+
+    static const opcode_handler_t normal_handlers[256];
+    static const opcode_handler_t cb_handlers[256];
+
     u8 get_byte_from_pc();
     s8 get_signed_byte_from_pc();
     u16 get_word_from_pc();
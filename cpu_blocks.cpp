@@ -0,0 +1,255 @@
+#include "cpu.h"
+#include "jit.h"
+#include "log.h"
+#include "mmu.h"
+#include "op_cycles.h"
+#include "op_lengths.h"
+
+/*
+	Cached interpreter: ROM/RAM code is decoded once into basic blocks of
+	(handler, immediates, cycles) and replayed without going through the
+	MMU for opcode and operand fetches. Timer, video and interrupts are
+	serviced at block boundaries.
+*/
+
+const opcode_handler_t CPU::normal_handlers[256] = {
+	&CPU::opcode_00, &CPU::opcode_01, &CPU::opcode_02, &CPU::opcode_03, &CPU::opcode_04, &CPU::opcode_05, &CPU::opcode_06, &CPU::opcode_07, &CPU::opcode_08, &CPU::opcode_09, &CPU::opcode_0A, &CPU::opcode_0B, &CPU::opcode_0C, &CPU::opcode_0D, &CPU::opcode_0E, &CPU::opcode_0F,
+	&CPU::opcode_10, &CPU::opcode_11, &CPU::opcode_12, &CPU::opcode_13, &CPU::opcode_14, &CPU::opcode_15, &CPU::opcode_16, &CPU::opcode_17, &CPU::opcode_18, &CPU::opcode_19, &CPU::opcode_1A, &CPU::opcode_1B, &CPU::opcode_1C, &CPU::opcode_1D, &CPU::opcode_1E, &CPU::opcode_1F,
+	&CPU::opcode_20, &CPU::opcode_21, &CPU::opcode_22, &CPU::opcode_23, &CPU::opcode_24, &CPU::opcode_25, &CPU::opcode_26, &CPU::opcode_27, &CPU::opcode_28, &CPU::opcode_29, &CPU::opcode_2A, &CPU::opcode_2B, &CPU::opcode_2C, &CPU::opcode_2D, &CPU::opcode_2E, &CPU::opcode_2F,
+	&CPU::opcode_30, &CPU::opcode_31, &CPU::opcode_32, &CPU::opcode_33, &CPU::opcode_34, &CPU::opcode_35, &CPU::opcode_36, &CPU::opcode_37, &CPU::opcode_38, &CPU::opcode_39, &CPU::opcode_3A, &CPU::opcode_3B, &CPU::opcode_3C, &CPU::opcode_3D, &CPU::opcode_3E, &CPU::opcode_3F,
+	&CPU::opcode_40, &CPU::opcode_41, &CPU::opcode_42, &CPU::opcode_43, &CPU::opcode_44, &CPU::opcode_45, &CPU::opcode_46, &CPU::opcode_47, &CPU::opcode_48, &CPU::opcode_49, &CPU::opcode_4A, &CPU::opcode_4B, &CPU::opcode_4C, &CPU::opcode_4D, &CPU::opcode_4E, &CPU::opcode_4F,
+	&CPU::opcode_50, &CPU::opcode_51, &CPU::opcode_52, &CPU::opcode_53, &CPU::opcode_54, &CPU::opcode_55, &CPU::opcode_56, &CPU::opcode_57, &CPU::opcode_58, &CPU::opcode_59, &CPU::opcode_5A, &CPU::opcode_5B, &CPU::opcode_5C, &CPU::opcode_5D, &CPU::opcode_5E, &CPU::opcode_5F,
+	&CPU::opcode_60, &CPU::opcode_61, &CPU::opcode_62, &CPU::opcode_63, &CPU::opcode_64, &CPU::opcode_65, &CPU::opcode_66, &CPU::opcode_67, &CPU::opcode_68, &CPU::opcode_69, &CPU::opcode_6A, &CPU::opcode_6B, &CPU::opcode_6C, &CPU::opcode_6D, &CPU::opcode_6E, &CPU::opcode_6F,
+	&CPU::opcode_70, &CPU::opcode_71, &CPU::opcode_72, &CPU::opcode_73, &CPU::opcode_74, &CPU::opcode_75, &CPU::opcode_76, &CPU::opcode_77, &CPU::opcode_78, &CPU::opcode_79, &CPU::opcode_7A, &CPU::opcode_7B, &CPU::opcode_7C, &CPU::opcode_7D, &CPU::opcode_7E, &CPU::opcode_7F,
+	&CPU::opcode_80, &CPU::opcode_81, &CPU::opcode_82, &CPU::opcode_83, &CPU::opcode_84, &CPU::opcode_85, &CPU::opcode_86, &CPU::opcode_87, &CPU::opcode_88, &CPU::opcode_89, &CPU::opcode_8A, &CPU::opcode_8B, &CPU::opcode_8C, &CPU::opcode_8D, &CPU::opcode_8E, &CPU::opcode_8F,
+	&CPU::opcode_90, &CPU::opcode_91, &CPU::opcode_92, &CPU::opcode_93, &CPU::opcode_94, &CPU::opcode_95, &CPU::opcode_96, &CPU::opcode_97, &CPU::opcode_98, &CPU::opcode_99, &CPU::opcode_9A, &CPU::opcode_9B, &CPU::opcode_9C, &CPU::opcode_9D, &CPU::opcode_9E, &CPU::opcode_9F,
+	&CPU::opcode_A0, &CPU::opcode_A1, &CPU::opcode_A2, &CPU::opcode_A3, &CPU::opcode_A4, &CPU::opcode_A5, &CPU::opcode_A6, &CPU::opcode_A7, &CPU::opcode_A8, &CPU::opcode_A9, &CPU::opcode_AA, &CPU::opcode_AB, &CPU::opcode_AC, &CPU::opcode_AD, &CPU::opcode_AE, &CPU::opcode_AF,
+	&CPU::opcode_B0, &CPU::opcode_B1, &CPU::opcode_B2, &CPU::opcode_B3, &CPU::opcode_B4, &CPU::opcode_B5, &CPU::opcode_B6, &CPU::opcode_B7, &CPU::opcode_B8, &CPU::opcode_B9, &CPU::opcode_BA, &CPU::opcode_BB, &CPU::opcode_BC, &CPU::opcode_BD, &CPU::opcode_BE, &CPU::opcode_BF,
+	&CPU::opcode_C0, &CPU::opcode_C1, &CPU::opcode_C2, &CPU::opcode_C3, &CPU::opcode_C4, &CPU::opcode_C5, &CPU::opcode_C6, &CPU::opcode_C7, &CPU::opcode_C8, &CPU::opcode_C9, &CPU::opcode_CA, &CPU::opcode_CB, &CPU::opcode_CC, &CPU::opcode_CD, &CPU::opcode_CE, &CPU::opcode_CF,
+	&CPU::opcode_D0, &CPU::opcode_D1, &CPU::opcode_D2, &CPU::opcode_D3, &CPU::opcode_D4, &CPU::opcode_D5, &CPU::opcode_D6, &CPU::opcode_D7, &CPU::opcode_D8, &CPU::opcode_D9, &CPU::opcode_DA, &CPU::opcode_DB, &CPU::opcode_DC, &CPU::opcode_DD, &CPU::opcode_DE, &CPU::opcode_DF,
+	&CPU::opcode_E0, &CPU::opcode_E1, &CPU::opcode_E2, &CPU::opcode_E3, &CPU::opcode_E4, &CPU::opcode_E5, &CPU::opcode_E6, &CPU::opcode_E7, &CPU::opcode_E8, &CPU::opcode_E9, &CPU::opcode_EA, &CPU::opcode_EB, &CPU::opcode_EC, &CPU::opcode_ED, &CPU::opcode_EE, &CPU::opcode_EF,
+	&CPU::opcode_F0, &CPU::opcode_F1, &CPU::opcode_F2, &CPU::opcode_F3, &CPU::opcode_F4, &CPU::opcode_F5, &CPU::opcode_F6, &CPU::opcode_F7, &CPU::opcode_F8, &CPU::opcode_F9, &CPU::opcode_FA, &CPU::opcode_FB, &CPU::opcode_FC, &CPU::opcode_FD, &CPU::opcode_FE, &CPU::opcode_FF,
+};
+
+const opcode_handler_t CPU::cb_handlers[256] = {
+	&CPU::opcode_CB_00, &CPU::opcode_CB_01, &CPU::opcode_CB_02, &CPU::opcode_CB_03, &CPU::opcode_CB_04, &CPU::opcode_CB_05, &CPU::opcode_CB_06, &CPU::opcode_CB_07, &CPU::opcode_CB_08, &CPU::opcode_CB_09, &CPU::opcode_CB_0A, &CPU::opcode_CB_0B, &CPU::opcode_CB_0C, &CPU::opcode_CB_0D, &CPU::opcode_CB_0E, &CPU::opcode_CB_0F,
+	&CPU::opcode_CB_10, &CPU::opcode_CB_11, &CPU::opcode_CB_12, &CPU::opcode_CB_13, &CPU::opcode_CB_14, &CPU::opcode_CB_15, &CPU::opcode_CB_16, &CPU::opcode_CB_17, &CPU::opcode_CB_18, &CPU::opcode_CB_19, &CPU::opcode_CB_1A, &CPU::opcode_CB_1B, &CPU::opcode_CB_1C, &CPU::opcode_CB_1D, &CPU::opcode_CB_1E, &CPU::opcode_CB_1F,
+	&CPU::opcode_CB_20, &CPU::opcode_CB_21, &CPU::opcode_CB_22, &CPU::opcode_CB_23, &CPU::opcode_CB_24, &CPU::opcode_CB_25, &CPU::opcode_CB_26, &CPU::opcode_CB_27, &CPU::opcode_CB_28, &CPU::opcode_CB_29, &CPU::opcode_CB_2A, &CPU::opcode_CB_2B, &CPU::opcode_CB_2C, &CPU::opcode_CB_2D, &CPU::opcode_CB_2E, &CPU::opcode_CB_2F,
+	&CPU::opcode_CB_30, &CPU::opcode_CB_31, &CPU::opcode_CB_32, &CPU::opcode_CB_33, &CPU::opcode_CB_34, &CPU::opcode_CB_35, &CPU::opcode_CB_36, &CPU::opcode_CB_37, &CPU::opcode_CB_38, &CPU::opcode_CB_39, &CPU::opcode_CB_3A, &CPU::opcode_CB_3B, &CPU::opcode_CB_3C, &CPU::opcode_CB_3D, &CPU::opcode_CB_3E, &CPU::opcode_CB_3F,
+	&CPU::opcode_CB_40, &CPU::opcode_CB_41, &CPU::opcode_CB_42, &CPU::opcode_CB_43, &CPU::opcode_CB_44, &CPU::opcode_CB_45, &CPU::opcode_CB_46, &CPU::opcode_CB_47, &CPU::opcode_CB_48, &CPU::opcode_CB_49, &CPU::opcode_CB_4A, &CPU::opcode_CB_4B, &CPU::opcode_CB_4C, &CPU::opcode_CB_4D, &CPU::opcode_CB_4E, &CPU::opcode_CB_4F,
+	&CPU::opcode_CB_50, &CPU::opcode_CB_51, &CPU::opcode_CB_52, &CPU::opcode_CB_53, &CPU::opcode_CB_54, &CPU::opcode_CB_55, &CPU::opcode_CB_56, &CPU::opcode_CB_57, &CPU::opcode_CB_58, &CPU::opcode_CB_59, &CPU::opcode_CB_5A, &CPU::opcode_CB_5B, &CPU::opcode_CB_5C, &CPU::opcode_CB_5D, &CPU::opcode_CB_5E, &CPU::opcode_CB_5F,
+	&CPU::opcode_CB_60, &CPU::opcode_CB_61, &CPU::opcode_CB_62, &CPU::opcode_CB_63, &CPU::opcode_CB_64, &CPU::opcode_CB_65, &CPU::opcode_CB_66, &CPU::opcode_CB_67, &CPU::opcode_CB_68, &CPU::opcode_CB_69, &CPU::opcode_CB_6A, &CPU::opcode_CB_6B, &CPU::opcode_CB_6C, &CPU::opcode_CB_6D, &CPU::opcode_CB_6E, &CPU::opcode_CB_6F,
+	&CPU::opcode_CB_70, &CPU::opcode_CB_71, &CPU::opcode_CB_72, &CPU::opcode_CB_73, &CPU::opcode_CB_74, &CPU::opcode_CB_75, &CPU::opcode_CB_76, &CPU::opcode_CB_77, &CPU::opcode_CB_78, &CPU::opcode_CB_79, &CPU::opcode_CB_7A, &CPU::opcode_CB_7B, &CPU::opcode_CB_7C, &CPU::opcode_CB_7D, &CPU::opcode_CB_7E, &CPU::opcode_CB_7F,
+	&CPU::opcode_CB_80, &CPU::opcode_CB_81, &CPU::opcode_CB_82, &CPU::opcode_CB_83, &CPU::opcode_CB_84, &CPU::opcode_CB_85, &CPU::opcode_CB_86, &CPU::opcode_CB_87, &CPU::opcode_CB_88, &CPU::opcode_CB_89, &CPU::opcode_CB_8A, &CPU::opcode_CB_8B, &CPU::opcode_CB_8C, &CPU::opcode_CB_8D, &CPU::opcode_CB_8E, &CPU::opcode_CB_8F,
+	&CPU::opcode_CB_90, &CPU::opcode_CB_91, &CPU::opcode_CB_92, &CPU::opcode_CB_93, &CPU::opcode_CB_94, &CPU::opcode_CB_95, &CPU::opcode_CB_96, &CPU::opcode_CB_97, &CPU::opcode_CB_98, &CPU::opcode_CB_99, &CPU::opcode_CB_9A, &CPU::opcode_CB_9B, &CPU::opcode_CB_9C, &CPU::opcode_CB_9D, &CPU::opcode_CB_9E, &CPU::opcode_CB_9F,
+	&CPU::opcode_CB_A0, &CPU::opcode_CB_A1, &CPU::opcode_CB_A2, &CPU::opcode_CB_A3, &CPU::opcode_CB_A4, &CPU::opcode_CB_A5, &CPU::opcode_CB_A6, &CPU::opcode_CB_A7, &CPU::opcode_CB_A8, &CPU::opcode_CB_A9, &CPU::opcode_CB_AA, &CPU::opcode_CB_AB, &CPU::opcode_CB_AC, &CPU::opcode_CB_AD, &CPU::opcode_CB_AE, &CPU::opcode_CB_AF,
+	&CPU::opcode_CB_B0, &CPU::opcode_CB_B1, &CPU::opcode_CB_B2, &CPU::opcode_CB_B3, &CPU::opcode_CB_B4, &CPU::opcode_CB_B5, &CPU::opcode_CB_B6, &CPU::opcode_CB_B7, &CPU::opcode_CB_B8, &CPU::opcode_CB_B9, &CPU::opcode_CB_BA, &CPU::opcode_CB_BB, &CPU::opcode_CB_BC, &CPU::opcode_CB_BD, &CPU::opcode_CB_BE, &CPU::opcode_CB_BF,
+	&CPU::opcode_CB_C0, &CPU::opcode_CB_C1, &CPU::opcode_CB_C2, &CPU::opcode_CB_C3, &CPU::opcode_CB_C4, &CPU::opcode_CB_C5, &CPU::opcode_CB_C6, &CPU::opcode_CB_C7, &CPU::opcode_CB_C8, &CPU::opcode_CB_C9, &CPU::opcode_CB_CA, &CPU::opcode_CB_CB, &CPU::opcode_CB_CC, &CPU::opcode_CB_CD, &CPU::opcode_CB_CE, &CPU::opcode_CB_CF,
+	&CPU::opcode_CB_D0, &CPU::opcode_CB_D1, &CPU::opcode_CB_D2, &CPU::opcode_CB_D3, &CPU::opcode_CB_D4, &CPU::opcode_CB_D5, &CPU::opcode_CB_D6, &CPU::opcode_CB_D7, &CPU::opcode_CB_D8, &CPU::opcode_CB_D9, &CPU::opcode_CB_DA, &CPU::opcode_CB_DB, &CPU::opcode_CB_DC, &CPU::opcode_CB_DD, &CPU::opcode_CB_DE, &CPU::opcode_CB_DF,
+	&CPU::opcode_CB_E0, &CPU::opcode_CB_E1, &CPU::opcode_CB_E2, &CPU::opcode_CB_E3, &CPU::opcode_CB_E4, &CPU::opcode_CB_E5, &CPU::opcode_CB_E6, &CPU::opcode_CB_E7, &CPU::opcode_CB_E8, &CPU::opcode_CB_E9, &CPU::opcode_CB_EA, &CPU::opcode_CB_EB, &CPU::opcode_CB_EC, &CPU::opcode_CB_ED, &CPU::opcode_CB_EE, &CPU::opcode_CB_EF,
+	&CPU::opcode_CB_F0, &CPU::opcode_CB_F1, &CPU::opcode_CB_F2, &CPU::opcode_CB_F3, &CPU::opcode_CB_F4, &CPU::opcode_CB_F5, &CPU::opcode_CB_F6, &CPU::opcode_CB_F7, &CPU::opcode_CB_F8, &CPU::opcode_CB_F9, &CPU::opcode_CB_FA, &CPU::opcode_CB_FB, &CPU::opcode_CB_FC, &CPU::opcode_CB_FD, &CPU::opcode_CB_FE, &CPU::opcode_CB_FF,
+};
+
+void CPU::enable_block_cache() {
+	// Writes below 0x8000 are MBC register writes, which may switch the bank
+	// the current block was decoded from.
+	for (uint page = 0x00; page < 0x80; page++) {
+		mmu->set_code_page(static_cast<u8>(page), true);
+	}
+}
+
+void CPU::enable_jit(bool verify) {
+	jit.reset(new Jit(*this));
+	if (!jit->available()) {
+		jit.reset();
+		return;
+	}
+	jit_verify = verify;
+}
+
+void CPU::flush_code() {
+	block_cache.flush();
+	if (jit) jit->reset();
+	for (uint page = 0x80; page < 0x100; page++) {
+		mmu->set_code_page(static_cast<u8>(page), false);
+	}
+}
+
+void CPU::code_write(u16 address) {
+	block_exit = true;
+	if (address < 0x8000) return;
+
+	// Self-modifying or reloaded RAM code: drop every RAM block
+	block_cache.flush_ram();
+	for (uint page = 0x80; page < 0x100; page++) {
+		mmu->set_code_page(static_cast<u8>(page), false);
+	}
+}
+
+// Region end for a block starting at pc, so blocks never straddle a bank or memory area
+static uint region_end(u16 pc) {
+	if (pc < 0x4000) return 0x4000;
+	if (pc < 0x8000) return 0x8000;
+	if (pc < 0xE000) return 0xE000;
+	return 0xFFFF;
+}
+
+int CPU::decode_block(u16 start_pc, uint bank) {
+	std::vector<DecodedInstruction> code;
+	code.reserve(BlockCache::MAX_BLOCK_LENGTH);
+
+	const uint end = region_end(start_pc);
+	uint addr = start_pc;
+
+	while (code.size() < BlockCache::MAX_BLOCK_LENGTH) {
+		// Instructions on pages with breakpoints always go through the interpreter
+		if (mmu->execute_watched(static_cast<u16>(addr))) break;
+
+		u8 opcode = mmu->read(Address(static_cast<u16>(addr)));
+		uint length = opcode_lengths[opcode];
+		if (addr + length > end) break;
+
+		DecodedInstruction in;
+		in.opcode = opcode;
+		in.imm[0] = 0;
+		in.imm[1] = 0;
+
+		if (opcode == 0xCB) {
+			u8 cb_opcode = mmu->read(Address(static_cast<u16>(addr + 1)));
+			in.imm[0] = cb_opcode;
+			in.handler = cb_handlers[cb_opcode];
+			in.cycles = u8(opcode_cycles_cb[cb_opcode] * CLOCKS_PER_M_CYCLE);
+			in.cycles_branched = in.cycles;
+		}
+		else {
+			for (uint i = 1; i < length; i++) {
+				in.imm[i - 1] = mmu->read(Address(static_cast<u16>(addr + i)));
+			}
+			in.handler = normal_handlers[opcode];
+			in.cycles = u8(opcode_cycles[opcode] * CLOCKS_PER_M_CYCLE);
+			in.cycles_branched = u8(opcode_cycles_branched[opcode] * CLOCKS_PER_M_CYCLE);
+		}
+
+		addr += length;
+		in.next_pc = static_cast<u16>(addr);
+		code.push_back(in);
+
+		if (opcode_ends_block(opcode)) break;
+	}
+
+	// An instruction straddling the region end: leave it to the interpreter
+	if (code.empty()) return BlockCache::NO_BLOCK;
+
+	if (start_pc >= 0x8000) {
+		for (uint page = start_pc >> 8; page <= ((addr - 1) >> 8); page++) {
+			mmu->set_code_page(static_cast<u8>(page), true);
+		}
+	}
+
+	return block_cache.insert(start_pc, bank, code);
+}
+
+Cycles CPU::tick_block() {
+	if (pending_interrupts) handle_interrupts();
+	if (halted) return Cycles(CLOCKS_PER_M_CYCLE);
+
+	const u16 start_pc = pc.value();
+	if (!BlockCache::cacheable(start_pc)) {
+		return step<Features::Fast>();
+	}
+	// MBC1 mode 1 can map another bank at 0x0000; blocks there are keyed as bank 0 only
+	if (start_pc < 0x4000 && mmu->low_rom_bank() != 0) {
+		return step<Features::Fast>();
+	}
+	// During OAM DMA the CPU fetches 0xFF outside HRAM; don't cache that as code
+	if (mmu->dma_active()) {
+		return step<Features::Fast>();
+	}
+	// Pages with breakpoints are never decoded, so don't try on every instruction
+	if (mmu->execute_watched(start_pc)) {
+		return step<Features::Fast>();
+	}
+
+	const uint bank = start_pc < 0x4000 ? 0 : mmu->rom_bank();
+	int id = block_cache.lookup(start_pc, bank);
+	if (id == BlockCache::NO_BLOCK) {
+		id = decode_block(start_pc, bank);
+		if (id == BlockCache::NO_BLOCK) return step<Features::Fast>();
+	}
+
+	Block& block = block_cache.block(id);
+	if (jit && !block.native && block.hits < Jit::HOT_THRESHOLD && ++block.hits == Jit::HOT_THRESHOLD) {
+		const DecodedInstruction* code = block_cache.instructions(block);
+		block.native = jit->compile(code, block.count);
+		block.verifiable = Jit::verifiable(code, block.count);
+		if (!block.native) {
+			log_debug("JIT code buffer full, flushing");
+			flush_code();
+			return step<Features::Fast>();
+		}
+	}
+
+	const uint cycles = block.native ? run_native(block) : run_decoded(block);
+
+	if (ei_pending) {
+		ei_pending = false;
+		interrupts_enabled = true;
+		update_pending_interrupts();
+	}
+
+	return Cycles(cycles);
+}
+
+uint CPU::run_decoded(const Block& block) {
+	const DecodedInstruction* in = block_cache.instructions(block);
+	const DecodedInstruction* end = in + block.count;
+
+	uint cycles = 0;
+	block_exit = false;
+
+	for (; in != end; ++in) {
+		branch_taken = false;
+		decoded_imm = in->imm;
+		pc.set(in->next_pc);
+
+		(this->*(in->handler))();
+
+		cycles += branch_taken ? in->cycles_branched : in->cycles;
+		if (block_exit) break;
+	}
+
+	decoded_imm = nullptr;
+	return cycles;
+}
+
+uint CPU::run_native(Block& block) {
+	block_exit = false;
+	jit_cycles = 0;
+
+	if (!jit_verify || !block.verifiable) {
+		block.native(this);
+		return jit_cycles;
+	}
+
+	// Differential check: native first, then the interpreter from the same state
+	const State before = state();
+	block.native(this);
+	const State native = state();
+	const uint native_cycles = jit_cycles;
+
+	restore(before);
+	const uint cycles = run_decoded(block);
+	const State interpreted = state();
+
+	if (native != interpreted || native_cycles != cycles) {
+		log_error("JIT mismatch in block at 0x%04X: native AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X PC=%04X cycles=%u, "
+			"interpreter AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X PC=%04X cycles=%u",
+			before.pc,
+			native.a, native.f, native.b, native.c, native.d, native.e, native.h, native.l, native.sp, native.pc, native_cycles,
+			interpreted.a, interpreted.f, interpreted.b, interpreted.c, interpreted.d, interpreted.e, interpreted.h, interpreted.l,
+			interpreted.sp, interpreted.pc, cycles);
+		block.native = nullptr;
+	}
+
+	return cycles;
+}
@@ -0,0 +1,232 @@
+#include "debugger.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "log.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Hex, with an optional 0x or $ prefix; false unless it fits in 16 bits
+bool parse_address(std::string text, u16& out) {
+    if (text.compare(0, 2, "0x") == 0 || text.compare(0, 2, "0X") == 0) text = text.substr(2);
+    else if (!text.empty() && text[0] == '$') text = text.substr(1);
+    if (text.empty() || text.size() > 4) return false;
+
+    char* end = nullptr;
+    const unsigned long value = std::strtoul(text.c_str(), &end, 16);
+    if (*end != '\0') return false;
+    out = u16(value);
+    return true;
+}
+
+bool is_register(const std::string& name) {
+    static const char* const names[] = { "a", "b", "c", "d", "e", "f", "h", "l", "bc", "de", "hl", "sp" };
+    for (const char* n : names) {
+        if (name == n) return true;
+    }
+    return false;
+}
+
+}
+
+Debugger::Debugger(CPU& inCPU, MMU& inMMU)
+    : cpu(inCPU)
+    , mmu(inMMU) {
+}
+
+bool Debugger::add_breakpoint(const std::string& spec) {
+    Breakpoint b = { 0, "", 0 };
+    const size_t colon = spec.find(':');
+    if (!parse_address(spec.substr(0, colon), b.address)) return false;
+
+    if (colon != std::string::npos) {
+        const std::string condition = spec.substr(colon + 1);
+        const size_t equals = condition.find('=');
+        if (equals == std::string::npos) return false;
+        b.reg = condition.substr(0, equals);
+        if (!is_register(b.reg) || !parse_address(condition.substr(equals + 1), b.value)) return false;
+    }
+
+    breakpoints.push_back(b);
+    mmu.set_watch(b.address, b.address, watch_kind::execute);
+    cpu.flush_code();
+    return true;
+}
+
+bool Debugger::add_watchpoint(const std::string& spec) {
+    const size_t colon = spec.find(':');
+    if (colon == std::string::npos) return false;
+
+    Watchpoint w = { 0, 0, 0 };
+    for (char kind : spec.substr(0, colon)) {
+        if (kind == 'r') w.kinds |= watch_kind::read;
+        else if (kind == 'w') w.kinds |= watch_kind::write;
+        else if (kind == 'x') w.kinds |= watch_kind::execute;
+        else return false;
+    }
+
+    const std::string range = spec.substr(colon + 1);
+    const size_t dash = range.find('-');
+    if (!parse_address(range.substr(0, dash), w.begin)) return false;
+    w.end = w.begin;
+    if (dash != std::string::npos && !parse_address(range.substr(dash + 1), w.end)) return false;
+    if (w.kinds == 0 || w.end < w.begin) return false;
+
+    watchpoints.push_back(w);
+    mmu.set_watch(w.begin, w.end, w.kinds);
+    if (w.kinds & watch_kind::execute) cpu.flush_code();
+    return true;
+}
+
+void Debugger::on_read(u16 addr) {
+    if (inspecting) return;
+    for (const Watchpoint& w : watchpoints) {
+        if ((w.kinds & watch_kind::read) && addr >= w.begin && addr <= w.end) {
+            char text[48];
+            std::snprintf(text, sizeof(text), "read 0x%04X", addr);
+            hit(text);
+            return;
+        }
+    }
+}
+
+void Debugger::on_write(u16 addr, u8 value) {
+    if (inspecting) return;
+    for (const Watchpoint& w : watchpoints) {
+        if ((w.kinds & watch_kind::write) && addr >= w.begin && addr <= w.end) {
+            char text[48];
+            std::snprintf(text, sizeof(text), "write 0x%02X to 0x%04X", value, addr);
+            hit(text);
+            return;
+        }
+    }
+}
+
+void Debugger::on_execute(u16 pc) {
+    for (const Breakpoint& b : breakpoints) {
+        if (b.address == pc && condition_holds(b)) {
+            char text[48];
+            std::snprintf(text, sizeof(text), "breakpoint at 0x%04X", pc);
+            hit(text);
+            return;
+        }
+    }
+    for (const Watchpoint& w : watchpoints) {
+        if ((w.kinds & watch_kind::execute) && pc >= w.begin && pc <= w.end) {
+            char text[48];
+            std::snprintf(text, sizeof(text), "execute 0x%04X", pc);
+            hit(text);
+            return;
+        }
+    }
+}
+
+bool Debugger::condition_holds(const Breakpoint& b) const {
+    if (b.reg.empty()) return true;
+
+    const CPU::State s = cpu.state();
+    const std::string& r = b.reg;
+    uint value = 0;
+    if (r == "a") value = s.a;
+    else if (r == "b") value = s.b;
+    else if (r == "c") value = s.c;
+    else if (r == "d") value = s.d;
+    else if (r == "e") value = s.e;
+    else if (r == "f") value = s.f;
+    else if (r == "h") value = s.h;
+    else if (r == "l") value = s.l;
+    else if (r == "bc") value = uint(s.b) << 8 | s.c;
+    else if (r == "de") value = uint(s.d) << 8 | s.e;
+    else if (r == "hl") value = uint(s.h) << 8 | s.l;
+    else if (r == "sp") value = s.sp;
+    return value == b.value;
+}
+
+// Memory hits come in the middle of an instruction; a cached block is
+// stopped after it so the prompt comes before the next one
+void Debugger::hit(const std::string& text) {
+    if (stop) return;
+    stop = true;
+    reason = text;
+    cpu.end_block();
+}
+
+void Debugger::print_registers() const {
+    const CPU::State s = cpu.state();
+    std::printf("AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X PC=%04X IME=%d%s\n",
+        s.a, s.f, s.b, s.c, s.d, s.e, s.h, s.l, s.sp, s.pc, s.ime ? 1 : 0, s.halted ? " (halted)" : "");
+}
+
+void Debugger::dump_memory(u16 addr, uint count) {
+    inspecting = true;
+    for (uint i = 0; i < count; i++) {
+        if (i % 16 == 0) std::printf(i ? "\n%04X:" : "%04X:", uint(u16(addr + i)));
+        std::printf(" %02X", mmu.read(Address(u16(addr + i))));
+    }
+    std::printf("\n");
+    inspecting = false;
+}
+
+bool Debugger::break_in() {
+    stop = false;
+    if (stepping) {
+        stepping = false;
+    }
+    else {
+        std::printf("Stopped: %s\n", reason.c_str());
+    }
+    print_registers();
+
+    std::string line;
+    while (true) {
+        std::printf("(gb) ");
+        std::fflush(stdout);
+        if (!std::getline(std::cin, line)) {
+            // No console to ask: keep running
+            log_info("Debugger: no input, continuing");
+            return true;
+        }
+
+        std::istringstream in(line);
+        std::string command, arg;
+        in >> command >> arg;
+
+        if (command.empty() || command == "c" || command == "continue") {
+            return true;
+        }
+        if (command == "s" || command == "step") {
+            stepping = true;
+            stop = true;
+            return true;
+        }
+        if (command == "q" || command == "quit") {
+            return false;
+        }
+        if (command == "r" || command == "regs") {
+            print_registers();
+        }
+        else if (command == "x") {
+            u16 addr;
+            std::string count_text;
+            in >> count_text;
+            if (!parse_address(arg, addr)) {
+                std::printf("Usage: x <addr> [count]\n");
+                continue;
+            }
+            const uint count = count_text.empty() ? 16 : uint(std::strtoul(count_text.c_str(), nullptr, 0));
+            dump_memory(addr, count);
+        }
+        else if (command == "b") {
+            if (!add_breakpoint(arg)) std::printf("Usage: b <addr>[:<reg>=<value>]\n");
+        }
+        else if (command == "w") {
+            if (!add_watchpoint(arg)) std::printf("Usage: w <r|w|x...>:<addr>[-<addr>]\n");
+        }
+        else {
+            std::printf("Commands: c(ontinue), s(tep), r(egs), x <addr> [count], b <spec>, w <spec>, q(uit)\n");
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+
+class CPU;
+class MMU;
+
+namespace watch_kind {
+    const u8 read    = 0x01;
+    const u8 write   = 0x02;
+    const u8 execute = 0x04;
+}
+
+/*
+    PC breakpoints (optionally on a register value) and read / write /
+    execute watchpoints on address ranges.
+
+    Nothing is checked per access or per instruction in general: the
+    pages a breakpoint or watchpoint covers are flagged in the MMU's
+    page table, and only accesses to flagged pages reach the debugger.
+    Execute checks only exist in the Debug core. A hit stops emulation
+    before the next instruction and prompts on the console.
+*/
+class Debugger {
+public:
+    Debugger(CPU& inCPU, MMU& inMMU);
+
+    // "0150" or "0150:a=3C" (registers a-l, bc, de, hl, sp); hex, an
+    // optional 0x or $ prefix. False if the spec doesn't parse.
+    bool add_breakpoint(const std::string& spec);
+    // "rw:C000-C0FF", "x:4000" and so on
+    bool add_watchpoint(const std::string& spec);
+
+    bool active() const { return !breakpoints.empty() || !watchpoints.empty(); }
+
+    // From the MMU, for accesses to flagged pages
+    void on_read(u16 addr);
+    void on_write(u16 addr, u8 value);
+    // From the Debug core, before instructions on flagged pages
+    void on_execute(u16 pc);
+
+    // Stops before the next instruction as if something was hit
+    void pause(const std::string& why) { hit(why); }
+
+    // A hit (or a single step) is waiting for break_in
+    bool stopped() const { return stop; }
+
+    // Reports the hit and takes commands until told to continue or
+    // step; false if the user quit
+    bool break_in();
+
+private:
+    struct Breakpoint {
+        u16 address;
+        std::string reg;    // empty for unconditional
+        u16 value;
+    };
+
+    struct Watchpoint {
+        u16 begin;
+        u16 end;            // inclusive
+        u8 kinds;
+    };
+
+    bool condition_holds(const Breakpoint& b) const;
+    void hit(const std::string& reason);
+    void print_registers() const;
+    void dump_memory(u16 addr, uint count);
+
+    CPU& cpu;
+    MMU& mmu;
+
+    std::vector<Breakpoint> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+
+    bool stop = false;
+    bool stepping = false;
+    // Set while the prompt reads memory, so that doesn't trigger watchpoints
+    bool inspecting = false;
+    std::string reason;
+};
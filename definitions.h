@@ -26,6 +26,10 @@ inline void unused(T&&...) {}
 // Forward decleration
 void log_error(const char* fmt, ...);
 
+// Everything counts clock (T) cycles at 4.194304 MHz; one machine (M)
+// cycle is four of them
+const uint CLOCKS_PER_M_CYCLE = 4;
+
 struct Cycles {
     explicit Cycles(uint32_t c) : cycles(c) {}
     uint32_t cycles;
@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+    Compile-time feature policies for the emulation core. The frame loop
+    and the CPU's interpreter step are instantiated once per policy, so
+    the Fast core carries no instrumentation at all. The Debug core has
+    it compiled in, still gated at runtime (by the log level and the
+    profiler switch). Gameboy picks one at startup from the options.
+*/
+namespace Features {
+
+struct Fast {
+    static const bool trace = false;     // log_trace for every instruction
+    static const bool profile = false;   // per-subsystem host timing
+    static const bool debugger = false;  // breakpoints and watchpoints
+};
+
+struct Debug {
+    static const bool trace = true;
+    static const bool profile = true;
+    static const bool debugger = true;
+};
+
+}
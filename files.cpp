@@ -4,6 +4,17 @@
 #include "definitions.h"
 #include "log.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
 std::vector<char> read_bytes(const std::string& filename) {
 	std::ifstream file(filename, std::ios::binary | std::ios::ate);
 	if (!file.good()) {
@@ -18,4 +29,57 @@ std::vector<char> read_bytes(const std::string& filename) {
 	file.close();
 	
 	return buffer;
-}
\ No newline at end of file
+}
+
+bool file_exists(const std::string& filename) {
+	std::ifstream file(filename, std::ios::binary);
+	return file.good();
+}
+
+bool make_directory(const std::string& path) {
+#ifdef _WIN32
+	_mkdir(path.c_str());
+	const DWORD attributes = GetFileAttributesA(path.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	mkdir(path.c_str(), 0755);
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+bool write_file_atomic(const std::string& filename, const std::vector<u8>& data) {
+	const std::string temp = filename + ".tmp";
+
+	FILE* file = std::fopen(temp.c_str(), "wb");
+	if (!file) {
+		log_error("Cannot open %s for writing", temp.c_str());
+		return false;
+	}
+
+	bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+	ok = std::fflush(file) == 0 && ok;
+#ifdef _WIN32
+	ok = _commit(_fileno(file)) == 0 && ok;
+#else
+	ok = fsync(fileno(file)) == 0 && ok;
+#endif
+	ok = std::fclose(file) == 0 && ok;
+
+	if (!ok) {
+		log_error("Failed to write %s", temp.c_str());
+		std::remove(temp.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	ok = MoveFileExA(temp.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	ok = std::rename(temp.c_str(), filename.c_str()) == 0;
+#endif
+	if (!ok) {
+		log_error("Failed to replace %s", filename.c_str());
+		std::remove(temp.c_str());
+	}
+	return ok;
+}
@@ -3,4 +3,17 @@
 #include <string>
 #include <vector>
 
-std::vector<char> read_bytes(const std::string& filename);
\ No newline at end of file
+#include "definitions.h"
+
+std::vector<char> read_bytes(const std::string& filename);
+
+bool file_exists(const std::string& filename);
+
+// Creates one directory level; true if it exists afterwards
+bool make_directory(const std::string& path);
+
+/*
+	Writes to `filename`.tmp, flushes it to disk and renames it over
+	`filename`, so a crash leaves either the old or the new file.
+*/
+bool write_file_atomic(const std::string& filename, const std::vector<u8>& data);
@@ -13,6 +13,13 @@ Color FrameBuffer::get_pixel(uint x, uint y) const {
     return buffer.at(pixel_index(x, y));
 }
 
+void FrameBuffer::set_line(uint y, const u8* shades) {
+    Color* row = &buffer[pixel_index(0, y)];
+    for (uint x = 0; x < width; x++) {
+        row[x] = static_cast<Color>(shades[x]);
+    }
+}
+
 void FrameBuffer::reset() {
     // Reset all pixels to white (or black, your choice :D)
     for (auto& pixel : buffer) {
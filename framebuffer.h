@@ -9,6 +9,8 @@ public:
 
     void set_pixel(uint x, uint y, Color color);
     Color get_pixel(uint x, uint y) const;
+    // A whole row of Color values stored as bytes
+    void set_line(uint y, const u8* shades);
 
     void reset();
 
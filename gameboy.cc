@@ -13,12 +13,55 @@ Gameboy::Gameboy(const std::vector<u8>& cartridge_data,
                  const std::vector<u8>& save_data)
     : cartridge(get_cartridge(cartridge_data, save_data))
     , cpu(*this, nullptr, options)       
-    , video(*this)  
-    , joypad()
-    , timer()
+    , video(*this, options.headless)
+    , joypad(cpu)
+    , timer(cpu, *this)
     , mmu(*cartridge, cpu, video, joypad, timer, *this) 
+    , debugger(cpu, mmu)
+    , idle_loop(cpu, mmu, video, timer)
 {
     cpu.setMMUPointer(&mmu);
+    mmu.set_debugger(&debugger);
+    profiler.set_enabled(options.profile);
+    video.set_frame_skip(options.frame_skip);
+    video.set_timing(options.accurate_ppu ? PpuTiming::PixelFifo : PpuTiming::Fixed);
+    if (options.render_thread)
+        video.start_render_thread();
+
+    throttle = !options.headless;
+
+    debug_core = options.trace || options.deubgger || options.profile;
+
+    cached_interpreter = options.cached_interpreter && !options.trace;
+    if (cached_interpreter)
+        cpu.enable_block_cache();
+    if (cached_interpreter && options.jit)
+        cpu.enable_jit(options.jit_verify);
+
+    for (const auto& spec : options.breakpoints) {
+        if (!debugger.add_breakpoint(spec)) log_error("Ignoring breakpoint '%s'", spec.c_str());
+    }
+    for (const auto& spec : options.watchpoints) {
+        if (!debugger.add_watchpoint(spec)) log_error("Ignoring watchpoint '%s'", spec.c_str());
+    }
+    // --debug on its own stops at the first instruction, where the
+    // prompt can set breakpoints
+    debugging = options.deubgger || debugger.active();
+    if (options.deubgger && !debugger.active())
+        debugger.pause("started with --debug");
+
+    idle_skip = options.idle_skip && !options.trace
+        && !idle_skip_disabled(cartridge->title(), "idle_skip_disable.txt");
+
+    if (!options.save_file.empty() && cartridge->has_battery()) {
+        const bool mapped = options.save_mmap && cartridge->map_save_file(options.save_file);
+        if (!mapped)
+            save_writer = std::make_unique<SaveWriter>(options.save_file);
+    }
+
+    if (options.rtc_emulated && cartridge->rtc()) {
+        cartridge->rtc()->set_time_source([this]() { return emulated_time_ns(); });
+    }
 
     if (options.disable_logs)
         log_set_level(LogLevel::Error);
@@ -28,63 +71,201 @@ Gameboy::Gameboy(const std::vector<u8>& cartridge_data,
         log_set_level(LogLevel::Info);
 }
 
+static const uint CYCLES_PER_FRAME = 70224;
+static const uint64_t CYCLES_PER_SECOND = 4194304;
+static const uint SAVE_INTERVAL_FRAMES = 60;
+
+uint64_t Gameboy::emulated_time_ns() const {
+    const uint64_t seconds = clock / CYCLES_PER_SECOND;
+    const uint64_t rest = clock % CYCLES_PER_SECOND;
+    return seconds * 1000000000ull + rest * 1000000000ull / CYCLES_PER_SECOND;
+}
+
 void Gameboy::run(
     const should_close_callback_t& _should_close_callback,
     const vblank_callback_t& _vblank_callback
 ) {
     should_close_callback = _should_close_callback;
-    video.register_vblank_callback(_vblank_callback);
 
-    const int CYCLES_PER_FRAME = 70224;
+    // The vblank callback runs inside video.tick, so when profiling we
+    // time it separately and take it back out of the PPU figure.
+    video.register_vblank_callback([this, _vblank_callback](const FrameBuffer& fb, bool rendered) {
+        if (!profiler.enabled()) {
+            _vblank_callback(fb, rendered);
+            return;
+        }
+        uint64_t start = Profiler::now_ns();
+        _vblank_callback(fb, rendered);
+        frontend_ns += Profiler::now_ns() - start;
+    });
+
     auto frame_start = std::chrono::steady_clock::now();
 
     while (true) {
-        if (should_close_callback()) break;
-
-        int cycles_this_frame = 0;
-        while (cycles_this_frame < CYCLES_PER_FRAME) {
-            auto c = cpu.tick();
-            timer.tick(c.cycles);
+        if (quit || should_close_callback()) break;
 
-            if (timer.consume_interrupt_request())
-                cpu.interrupt_flag.set_bit_to(2, true);
-            if (joypad.consume_interrupt_request())
-                cpu.interrupt_flag.set_bit_to(4, true);
+        // The profiler can also be switched on from the frontend
+        if (debug_core || profiler.enabled())
+            dispatch_frame<Features::Debug>();
+        else
+            dispatch_frame<Features::Fast>();
 
-            video.tick(c);
-            cycles_this_frame += c.cycles;
+        if (++frames_since_save >= SAVE_INTERVAL_FRAMES) {
+            frames_since_save = 0;
+            flush_save();
         }
 
-        auto frame_end = std::chrono::steady_clock::now();
+        auto frame_stop = std::chrono::steady_clock::now();
         auto frame_duration = std::chrono::duration_cast<std::chrono::microseconds>(
-            frame_end - frame_start).count();
+            frame_stop - frame_start).count();
 
-        if (frame_duration < 16742) {
+        if (throttle && frame_duration < 16742) {
             std::this_thread::sleep_for(
                 std::chrono::microseconds(16742 - frame_duration));
         }
 
         frame_start = std::chrono::steady_clock::now();
     }
+
+    flush_save(true);
 }
 
-void Gameboy::tick() {
-    auto cycles = cpu.tick();
+// Only the snapshot is taken here; the disk write happens on the writer's
+// thread, or for a mapped save in the kernel's writeback
+void Gameboy::flush_save(bool wait) {
+    if (cartridge->save_mapped()) {
+        if (cartridge->take_ram_dirty() || wait)
+            cartridge->sync_save(wait);
+        return;
+    }
+    if (!save_writer || !cartridge->take_ram_dirty()) return;
+    save_writer->submit(cartridge->get_save_data());
+}
+
+template <class F>
+void Gameboy::dispatch_frame() {
+    const bool fifo = video.timing() == PpuTiming::PixelFifo;
+    if (F::profile && profiler.enabled())
+        fifo ? run_frame_profiled<F, PpuTiming::PixelFifo>() : run_frame_profiled<F, PpuTiming::Fixed>();
+    else
+        fifo ? run_frame<F, PpuTiming::PixelFifo>() : run_frame<F, PpuTiming::Fixed>();
+}
 
-    timer.tick(cycles.cycles);
+bool Gameboy::debug_check() {
+    cpu.dispatch_interrupts();
+    const u16 pc = cpu.program_counter();
+    if (mmu.execute_watched(pc) && !cpu.is_halted()) debugger.on_execute(pc);
 
-    if (timer.consume_interrupt_request()) {
-        cpu.interrupt_flag.set_bit_to(2, true);
+    if (debugger.stopped() && !debugger.break_in()) {
+        quit = true;
+        return false;
     }
+    return true;
+}
+
+template <class F, PpuTiming Timing>
+void Gameboy::run_frame() {
+    frame_end += CYCLES_PER_FRAME;
+    while (clock < frame_end) {
+        if (F::debugger && debugging && !debug_check()) return;
+
+        // Single steps go one instruction at a time, not a block
+        const bool interpret = !cached_interpreter || (F::debugger && debugger.stopped());
+        const u16 start_pc = cpu.program_counter();
+        auto c = interpret ? cpu.tick<F>() : cpu.tick_block();
+        clock += c.cycles;
+        timer.tick(clock);
+        mmu.tick_dma(c.cycles);
+        video.tick<Timing>();
+
+        if (idle_skip)
+            skip_idle_loop<Timing>(start_pc, c.cycles);
+    }
+}
+
+template <PpuTiming Timing>
+void Gameboy::skip_idle_loop(u16 start_pc, uint cycles) {
+    // Never skip past the frame end, where the frontend may change the joypad
+    const uint budget = clock < frame_end ? uint(frame_end - clock) : 0;
+    const uint skip = idle_loop.observe(start_pc, cycles, budget);
+    if (!skip) return;
+
+    clock += skip;
+    timer.tick(clock);
+    mmu.tick_dma(skip);
+    video.tick<Timing>();
+}
+
+template <class F, PpuTiming Timing>
+void Gameboy::run_frame_profiled() {
+    // Reading the clock costs about as much as a short instruction, so
+    // only one iteration in PROFILE_SAMPLE_INTERVAL is split by subsystem.
+    // The frame's measured time is then divided in the sampled ratios.
+    uint64_t cpu_ns = 0;
+    uint64_t timer_ns = 0;
+    uint64_t video_ns = 0;
+    uint sample_countdown = 0;
+    frontend_ns = 0;
+
+    profiler.begin_frame();
+    const uint64_t frame_begin = Profiler::now_ns();
 
-    if (joypad.consume_interrupt_request()) {
-        cpu.interrupt_flag.set_bit_to(4, true);
+    frame_end += CYCLES_PER_FRAME;
+    while (clock < frame_end) {
+        if (F::debugger && debugging && !debug_check()) return;
+
+        const bool sample = sample_countdown-- == 0;
+        uint64_t t0 = 0, t1 = 0, t2 = 0, frontend_before = 0;
+        if (sample) {
+            sample_countdown = PROFILE_SAMPLE_INTERVAL - 1;
+            frontend_before = frontend_ns;
+            t0 = Profiler::now_ns();
+        }
+
+        const bool interpret = !cached_interpreter || (F::debugger && debugger.stopped());
+        const u16 start_pc = cpu.program_counter();
+        auto c = interpret ? cpu.tick<F>() : cpu.tick_block();
+        clock += c.cycles;
+
+        if (sample) t1 = Profiler::now_ns();
+        timer.tick(clock);
+        mmu.tick_dma(c.cycles);
+
+        if (sample) t2 = Profiler::now_ns();
+        video.tick<Timing>();
+
+        // Skipped idle time is mostly video work, so it is counted as PPU
+        if (idle_skip)
+            skip_idle_loop<Timing>(start_pc, c.cycles);
+
+        if (sample) {
+            // A frame handed to the frontend here is timed separately
+            const uint64_t presented = frontend_ns - frontend_before;
+            const uint64_t t3 = Profiler::now_ns();
+            cpu_ns   += t1 - t0;
+            timer_ns += t2 - t1;
+            video_ns += t3 - t2 > presented ? t3 - t2 - presented : 0;
+        }
     }
 
-    elapsed_cycles += cycles.cycles;
-    video.tick(cycles);
+    const uint64_t frame_ns = Profiler::now_ns() - frame_begin;
+    const uint64_t emulated_ns = frame_ns > frontend_ns ? frame_ns - frontend_ns : 0;
+    const uint64_t sampled_ns = cpu_ns + timer_ns + video_ns;
+    auto share = [&](uint64_t ns) {
+        return sampled_ns ? uint64_t(double(emulated_ns) * ns / sampled_ns) : 0;
+    };
+
+    profiler.add(ProfileSection::CPU, share(cpu_ns));
+    profiler.add(ProfileSection::Timer, share(timer_ns));
+    profiler.add(ProfileSection::PPU, share(video_ns));
+    profiler.add(ProfileSection::Frame, frame_ns);
+    profiler.end_frame();
+}
+
+auto Gameboy::get_cartridge_ram() const -> std::vector<u8> {
+    return cartridge->get_cartridge_ram().contents();
 }
 
-auto Gameboy::get_cartridge_ram() const -> const std::vector<u8>& {
-    return cartridge->get_cartridge_ram();
+auto Gameboy::get_save_data() const -> std::vector<u8> {
+    return cartridge->get_save_data();
 }
\ No newline at end of file
@@ -9,6 +9,11 @@
 #include "mmu.h"  
 #include "joypad.h"
 #include "timer.h"
+#include "profiler.h"
+#include "idle_loop.h"
+#include "save_writer.h"
+#include "features.h"
+#include "debugger.h"
 
 #include <memory>
 #include <functional>
@@ -16,7 +21,7 @@
 
 class FrameBuffer;
 
-using vblank_callback_t = std::function<void(const FrameBuffer&)>;
+using vblank_callback_t = std::function<void(const FrameBuffer&, bool rendered)>;
 using should_close_callback_t = std::function<bool()>;
 
 class Gameboy {
@@ -29,6 +34,10 @@ public:
     Joypad joypad;
     Timer timer;
     MMU mmu;
+    Debugger debugger;
+
+    // Per-frame host timing, only collected when enabled
+    Profiler profiler;
 
     Gameboy(const std::vector<u8>& cartridge_data, 
             Options& options,
@@ -39,10 +48,57 @@ public:
         const vblank_callback_t& _vblank_callback
     );
 
-    auto get_cartridge_ram() const -> const std::vector<u8>&;
+    // Clock cycles since power-on. Advanced once per CPU step, before the
+    // other components catch up to it.
+    uint64_t now() const { return clock; }
+
+    auto get_cartridge_ram() const -> std::vector<u8>;
+    auto get_save_data() const -> std::vector<u8>;
 
 private:
-    void tick();
-    uint elapsed_cycles = 0;
+    // Debug core, before each instruction: checks breakpoints on the
+    // next PC and prompts for a pending hit. False once the user quits.
+    bool debug_check();
+
+    // Picks the frame loop for the current PPU timing and profiler state
+    template <class F> void dispatch_frame();
+
+    // One emulated frame; the profiled variant times each subsystem.
+    // Instantiated per feature policy and PPU timing, so the fast,
+    // fixed-timing loop has no instrumentation or accuracy checks in it.
+    template <class F, PpuTiming Timing> void run_frame();
+    template <class F, PpuTiming Timing> void run_frame_profiled();
+
+    // Advances the clock past an idle polling loop, if one was found
+    template <PpuTiming Timing>
+    void skip_idle_loop(u16 start_pc, uint cycles);
+
+    uint64_t emulated_time_ns() const;
+
+    // Hands changed battery RAM to the save writer (or syncs the mapped
+    // save file) every SAVE_INTERVAL_FRAMES; `wait` on exit
+    void flush_save(bool wait = false);
+
+    IdleLoopDetector idle_loop;
+    bool idle_skip = false;
+
+    // Also the RTC clock with --rtc-emulated
+    uint64_t clock = 0;
+    // Frames end on fixed boundaries, so an instruction running over one
+    // shortens the next frame instead of drifting
+    uint64_t frame_end = 0;
+
+    std::unique_ptr<SaveWriter> save_writer;
+    uint frames_since_save = 0;
+    bool cached_interpreter = false;
+    // Features::Debug for --trace, --debug and --profile
+    bool debug_core = false;
+    bool debugging = false;     // --debug, or breakpoints or watchpoints are set
+    bool quit = false;
+    // Hold frames to 60 per second; off when headless
+    bool throttle = true;
+    uint64_t frontend_ns = 0;
+    // Profiled frames time one loop iteration in this many
+    static const uint PROFILE_SAMPLE_INTERVAL = 64;
     should_close_callback_t should_close_callback;
 };
@@ -0,0 +1,134 @@
+/*
+    gb-index: builds and queries the ROM library index.
+
+        gb-index build <rom-dir> <index-file> [--threads N]
+        gb-index query <index-file> <crc32 | sha1>
+        gb-index list <index-file>
+
+    Building reads every .gb/.gbc (optionally .gz/.zip/.zst) file
+    under the directory on a pool of threads; the index itself is
+    described in rom_index.h.
+*/
+#include "rom_index.h"
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static bool is_rom_file(const fs::path& path) {
+    std::string ext = path.extension().string();
+    for (char& c : ext) if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    return ext == ".gb" || ext == ".gbc" || ext == ".gz" || ext == ".zip" || ext == ".zst";
+}
+
+static void print_entry(const RomIndexEntry& e) {
+    std::printf("%08x %s %8u %02x %-16s %s\n", e.crc32, describe_sha1(e.sha1).c_str(),
+                e.rom_size, e.cartridge_type, e.title.c_str(), e.path.c_str());
+}
+
+static int build(const std::string& dir, const std::string& index_file, uint threads) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::string> files;
+    std::error_code error;
+    for (fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, error), end;
+         it != end; it.increment(error)) {
+        if (error) break;
+        if (it->is_regular_file(error) && is_rom_file(it->path())) files.push_back(it->path().string());
+    }
+    if (error) {
+        std::cerr << "Cannot scan " << dir << ": " << error.message() << "\n";
+        return 1;
+    }
+
+    // Files are handed out one at a time, so large ROMs don't stall a whole slice
+    std::vector<RomIndexEntry> entries(files.size());
+    std::vector<char> valid(files.size(), 0);
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            valid[i] = index_rom(files[i], entries[i]);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (uint i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    std::vector<RomIndexEntry> roms;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (valid[i]) roms.push_back(std::move(entries[i]));
+        else std::cerr << "Skipping " << files[i] << ": not a readable ROM\n";
+    }
+    sort_index(roms);
+
+    if (!write_index(index_file, roms)) return 1;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::printf("Indexed %u ROMs (%u files) with %u threads in %lld ms\n",
+                uint(roms.size()), uint(files.size()), threads, (long long)ms);
+    return 0;
+}
+
+static int query(const std::string& index_file, const std::string& key) {
+    RomIndex index;
+    if (!index.load(index_file)) return 1;
+
+    std::vector<RomIndexEntry> found;
+    u8 digest[SHA1_SIZE];
+    if (parse_sha1(key, digest)) {
+        found = index.find_sha1(digest);
+    }
+    else if (key.size() <= 8 && key.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos) {
+        found = index.find_crc32(uint32_t(std::stoul(key, nullptr, 16)));
+    }
+    else {
+        std::cerr << "Expected a CRC-32 or SHA-1 in hex: " << key << "\n";
+        return 1;
+    }
+
+    for (const auto& e : found) print_entry(e);
+    return found.empty() ? 1 : 0;
+}
+
+static int list(const std::string& index_file) {
+    RomIndex index;
+    if (!index.load(index_file)) return 1;
+    RomIndexEntry e;
+    for (size_t i = 0; i < index.size(); i++) {
+        if (!index.entry(i, e)) return 1;
+        print_entry(e);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    log_set_level(LogLevel::Error);
+
+    const std::string command = argc > 1 ? argv[1] : "";
+    if (command == "build" && argc >= 4) {
+        uint threads = std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 4; i + 1 < argc; i++) {
+            if (std::string(argv[i]) == "--threads") threads = std::max(1, std::atoi(argv[++i]));
+        }
+        return build(argv[2], argv[3], threads);
+    }
+    if (command == "query" && argc == 4) return query(argv[2], argv[3]);
+    if (command == "list" && argc == 3) return list(argv[2]);
+
+    std::cerr << "Usage:\n"
+              << "  gb-index build <rom-dir> <index-file> [--threads N]\n"
+              << "  gb-index query <index-file> <crc32 | sha1>\n"
+              << "  gb-index list <index-file>\n";
+    return 1;
+}
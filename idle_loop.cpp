@@ -0,0 +1,94 @@
+#include "idle_loop.h"
+#include "mmu.h"
+#include "video.h"
+#include "timer.h"
+#include "log.h"
+
+#include <algorithm>
+#include <fstream>
+
+const uint IdleLoopDetector::MAX_LOOP_BYTES;
+const uint IdleLoopDetector::CONFIRMATIONS;
+
+IdleLoopDetector::IdleLoopDetector(CPU& inCPU, MMU& inMMU, Video& inVideo, Timer& inTimer)
+    : cpu(inCPU)
+    , mmu(inMMU)
+    , video(inVideo)
+    , timer(inTimer) {
+}
+
+void IdleLoopDetector::track(u16 head_pc) {
+    tracking = true;
+    head = head_pc;
+    head_state = cpu.state();
+    period = 0;
+    iteration_cycles = 0;
+    horizon_at_head = 0;
+    confirmations = 0;
+    mmu.begin_probe();
+}
+
+uint IdleLoopDetector::observe(u16 start_pc, uint cycles, uint budget) {
+    iteration_cycles += cycles;
+
+    // Only a jump back to (or a HALT at) a nearby address ends an iteration
+    const u16 pc = cpu.program_counter();
+    if (pc > start_pc || uint(start_pc - pc) > MAX_LOOP_BYTES) return 0;
+
+    if (!tracking || pc != head) {
+        track(pc);
+        return 0;
+    }
+
+    const MMU::Probe probe = mmu.end_probe();
+    const CPU::State now = cpu.state();
+
+    // The iteration could only have seen inputs it will see again if no
+    // event fell inside it; interrupts raised by one are caught here too
+    const bool quiet = horizon_at_head > iteration_cycles;
+    const bool identical = quiet && !probe.wrote && !probe.read_volatile
+        && now == head_state && iteration_cycles == period;
+
+    // Nothing the loop reads can change before the next video mode change,
+    // timer interrupt, DIV/TIMA step it reads, or the end of the budget
+    uint horizon = std::min(video.cycles_until_event(), budget);
+    horizon = std::min<uint>(horizon, timer.cycles_until_change(probe.read_div, probe.read_tima));
+    // The end of an OAM DMA gives the bus back, so reads stop returning 0xFF
+    if (mmu.dma_active()) horizon = std::min(horizon, mmu.dma_cycles_remaining());
+
+    head_state = now;
+    period = iteration_cycles;
+    iteration_cycles = 0;
+    horizon_at_head = horizon;
+    mmu.begin_probe();
+
+    if (!identical || period == 0) {
+        confirmations = 0;
+        return 0;
+    }
+    if (confirmations < CONFIRMATIONS) {
+        confirmations++;
+        return 0;
+    }
+
+    const uint skip = horizon - horizon % period;
+    horizon_at_head -= skip;
+    total_skipped += skip;
+    return skip;
+}
+
+bool idle_skip_disabled(const std::string& title, const std::string& list_file) {
+    std::ifstream file(list_file);
+    if (!file.good()) return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        if (line == title) {
+            log_info("Idle-loop skipping disabled for '%s' by %s", title.c_str(), list_file.c_str());
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+
+#include "definitions.h"
+#include "cpu.h"
+
+class MMU;
+class Video;
+class Timer;
+
+/*
+    Detects side-effect-free polling loops (LY/STAT waits, flag
+    polling in RAM, HALT) and tells the caller how far it may run the
+    rest of the machine without the CPU.
+
+    A loop head is any address the CPU jumps back to within a short
+    distance. An iteration counts as idle when it wrote nothing, read
+    nothing that changes on its own except what the horizon accounts
+    for, and left the registers, IME and cycle count exactly as the
+    previous one did. After a few such iterations every further one
+    is known to be identical until an I/O register or interrupt flag
+    changes, so whole iterations up to that point can be skipped.
+*/
+class IdleLoopDetector {
+public:
+    IdleLoopDetector(CPU& inCPU, MMU& inMMU, Video& inVideo, Timer& inTimer);
+
+    // Call after every CPU step with the PC it started at and the cycles
+    // it used. Returns how many cycles (at most `budget`) the caller may
+    // advance timer and video by without running the CPU.
+    uint observe(u16 start_pc, uint cycles, uint budget);
+
+    uint64_t skipped_cycles() const { return total_skipped; }
+
+private:
+    // Largest backward jump still treated as a polling loop
+    static const uint MAX_LOOP_BYTES = 64;
+    // Identical iterations required before skipping
+    static const uint CONFIRMATIONS = 2;
+
+    void track(u16 head_pc);
+
+    CPU& cpu;
+    MMU& mmu;
+    Video& video;
+    Timer& timer;
+
+    bool tracking = false;
+    u16 head = 0;
+    CPU::State head_state = {};
+    uint period = 0;
+    uint iteration_cycles = 0;
+    uint horizon_at_head = 0;   // cycles until the next event, as of the head
+    uint confirmations = 0;
+
+    uint64_t total_skipped = 0;
+};
+
+// Whether the ROM title appears in the idle-skip disable list file
+bool idle_skip_disabled(const std::string& title, const std::string& list_file);
@@ -0,0 +1,256 @@
+#include "inflate.h"
+#include "log.h"
+
+namespace {
+
+const int MAX_BITS = 15;
+const int MAX_LENGTH_CODES = 288;
+const int MAX_DISTANCE_CODES = 30;
+
+const u16 length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const u8 length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const u16 distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const u8 distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Order the code length code lengths are sent in
+const u8 code_length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+class BitReader {
+public:
+    BitReader(const u8* inData, size_t inSize) : data(inData), size(inSize) {}
+
+    uint bits(int n) {
+        while (count < n) {
+            if (pos == size) {
+                overrun = true;
+                return 0;
+            }
+            buffer |= uint32_t(data[pos++]) << count;
+            count += 8;
+        }
+        const uint value = buffer & ((1u << n) - 1);
+        buffer >>= n;
+        count -= n;
+        return value;
+    }
+
+    // Stored blocks start on a byte boundary
+    void align() {
+        buffer = 0;
+        count = 0;
+    }
+
+    bool read_bytes(std::vector<u8>& out, size_t n) {
+        if (size - pos < n) {
+            overrun = true;
+            return false;
+        }
+        out.insert(out.end(), data + pos, data + pos + n);
+        pos += n;
+        return true;
+    }
+
+    size_t position() const { return pos; }
+    bool failed() const { return overrun; }
+
+private:
+    const u8* data;
+    size_t size;
+    size_t pos = 0;
+    uint32_t buffer = 0;
+    int count = 0;
+    bool overrun = false;
+};
+
+// Canonical Huffman code as per-length counts plus symbols in code order
+struct Huffman {
+    u16 counts[MAX_BITS + 1];
+    u16 symbols[MAX_LENGTH_CODES];
+
+    // False if the lengths are over-subscribed; incomplete codes are allowed
+    bool build(const u8* lengths, int n) {
+        for (int len = 0; len <= MAX_BITS; len++) counts[len] = 0;
+        for (int i = 0; i < n; i++) counts[lengths[i]]++;
+        counts[0] = 0;
+
+        int left = 1;
+        for (int len = 1; len <= MAX_BITS; len++) {
+            left <<= 1;
+            left -= counts[len];
+            if (left < 0) return false;
+        }
+
+        u16 offsets[MAX_BITS + 1];
+        offsets[1] = 0;
+        for (int len = 1; len < MAX_BITS; len++) offsets[len + 1] = offsets[len] + counts[len];
+        for (int i = 0; i < n; i++) {
+            if (lengths[i]) symbols[offsets[lengths[i]]++] = u16(i);
+        }
+        return true;
+    }
+
+    // Returns -1 on a code that is not in the table
+    int decode(BitReader& in) const {
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len <= MAX_BITS; len++) {
+            code |= in.bits(1);
+            const int count = counts[len];
+            if (code - first < count) return symbols[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+// Output past max_size fails the stream, so a tiny input can't expand without bound
+bool inflate_codes(BitReader& in, std::vector<u8>& out, size_t max_size,
+                   const Huffman& lengths, const Huffman& distances) {
+    while (true) {
+        const int symbol = lengths.decode(in);
+        if (symbol < 0 || in.failed()) return false;
+
+        if (symbol < 256) {
+            if (out.size() >= max_size) return false;
+            out.push_back(u8(symbol));
+            continue;
+        }
+        if (symbol == 256) return true;
+
+        const int l = symbol - 257;
+        if (l >= 29) return false;
+        const size_t length = length_base[l] + in.bits(length_extra[l]);
+
+        const int d = distances.decode(in);
+        if (d < 0 || d >= MAX_DISTANCE_CODES) return false;
+        const size_t distance = distance_base[d] + in.bits(distance_extra[d]);
+        if (in.failed() || distance > out.size() || length > max_size - out.size()) return false;
+
+        // Overlapping copies repeat the last `distance` bytes, so go byte by byte
+        size_t from = out.size() - distance;
+        for (size_t i = 0; i < length; i++) out.push_back(out[from + i]);
+    }
+}
+
+struct FixedTables {
+    Huffman lengths;
+    Huffman distances;
+};
+
+FixedTables make_fixed_tables() {
+    FixedTables tables;
+    u8 l[MAX_LENGTH_CODES];
+    int i = 0;
+    for (; i < 144; i++) l[i] = 8;
+    for (; i < 256; i++) l[i] = 9;
+    for (; i < 280; i++) l[i] = 7;
+    for (; i < MAX_LENGTH_CODES; i++) l[i] = 8;
+    tables.lengths.build(l, MAX_LENGTH_CODES);
+
+    for (i = 0; i < MAX_DISTANCE_CODES; i++) l[i] = 5;
+    tables.distances.build(l, MAX_DISTANCE_CODES);
+    return tables;
+}
+
+bool inflate_fixed(BitReader& in, std::vector<u8>& out, size_t max_size) {
+    // Built once, thread-safely, on first use (gb-index inflates on a pool)
+    static const FixedTables tables = make_fixed_tables();
+    return inflate_codes(in, out, max_size, tables.lengths, tables.distances);
+}
+
+bool inflate_dynamic(BitReader& in, std::vector<u8>& out, size_t max_size) {
+    const int nlen = in.bits(5) + 257;
+    const int ndist = in.bits(5) + 1;
+    const int ncode = in.bits(4) + 4;
+    if (nlen > 286 || ndist > MAX_DISTANCE_CODES) return false;
+
+    u8 l[MAX_LENGTH_CODES + MAX_DISTANCE_CODES] = {};
+    for (int i = 0; i < ncode; i++) l[code_length_order[i]] = u8(in.bits(3));
+
+    Huffman code_lengths;
+    if (!code_lengths.build(l, 19)) return false;
+
+    // Literal/length and distance code lengths, run-length coded together
+    int index = 0;
+    while (index < nlen + ndist) {
+        int symbol = code_lengths.decode(in);
+        if (symbol < 0 || in.failed()) return false;
+
+        if (symbol < 16) {
+            l[index++] = u8(symbol);
+            continue;
+        }
+
+        u8 value = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (index == 0) return false;
+            value = l[index - 1];
+            repeat = 3 + in.bits(2);
+        }
+        else if (symbol == 17) {
+            repeat = 3 + in.bits(3);
+        }
+        else {
+            repeat = 11 + in.bits(7);
+        }
+        if (index + repeat > nlen + ndist) return false;
+        while (repeat--) l[index++] = value;
+    }
+
+    // Without an end-of-block code the block could never finish
+    if (l[256] == 0) return false;
+
+    Huffman lengths, distances;
+    if (!lengths.build(l, nlen)) return false;
+    if (!distances.build(l + nlen, ndist)) return false;
+
+    return inflate_codes(in, out, max_size, lengths, distances);
+}
+
+}
+
+bool inflate(const u8* in, size_t in_size, std::vector<u8>& out, size_t max_size, size_t* consumed) {
+    BitReader reader(in, in_size);
+
+    bool last = false;
+    while (!last) {
+        last = reader.bits(1) != 0;
+        const uint type = reader.bits(2);
+
+        bool ok;
+        switch (type) {
+            case 0: {
+                reader.align();
+                std::vector<u8> header;
+                if (!reader.read_bytes(header, 4)) return false;
+                const uint len = header[0] | (header[1] << 8);
+                const uint nlen = header[2] | (header[3] << 8);
+                ok = (len ^ 0xFFFF) == nlen && len <= max_size - out.size() && reader.read_bytes(out, len);
+                break;
+            }
+            case 1: ok = inflate_fixed(reader, out, max_size); break;
+            case 2: ok = inflate_dynamic(reader, out, max_size); break;
+            default: ok = false; break;
+        }
+
+        if (!ok || reader.failed()) {
+            log_error("Corrupt deflate stream, or one over %u bytes, at input byte %u", uint(max_size), uint(reader.position()));
+            return false;
+        }
+    }
+
+    if (consumed) *consumed = reader.position();
+    return true;
+}
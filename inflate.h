@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+
+#include "definitions.h"
+
+/*
+    Small DEFLATE (RFC 1951) decoder for compressed ROMs: stored,
+    fixed and dynamic Huffman blocks, appended to `out`. Fails once
+    `out` would grow past `max_size` bytes. `consumed`
+    receives how many input bytes the stream used, so container
+    trailers (gzip CRC and size) can be found after it. Safe to call
+    from several threads at once.
+*/
+bool inflate(const u8* in, size_t in_size, std::vector<u8>& out, size_t max_size,
+             size_t* consumed = nullptr);
@@ -0,0 +1,430 @@
+#include "jit.h"
+#include "cpu.h"
+#include "log.h"
+
+#include <algorithm>
+
+#if JIT_SUPPORTED
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+static const size_t CODE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+/*
+    Host registers holding the guest ones. Indexed by the SM83
+    register encoding B, C, D, E, H, L, (HL), A; (HL) has none.
+*/
+static const int HOST_A = 8;
+static const int HOST_F = 9;
+static const int NO_HOST = -1;
+static const int host_register[8] = { 10, 11, 12, 13, 14, 15, NO_HOST, 8 };
+
+// x86 LAHF layout (CF bit 0, AF bit 4, ZF bit 6) -> SM83 C, H, Z flags
+struct LahfTable {
+    u8 flags[256];
+    LahfTable() {
+        for (uint i = 0; i < 256; i++) {
+            flags[i] = static_cast<u8>(((i & 0x40) ? 0x80 : 0) |
+                                       ((i & 0x10) ? 0x20 : 0) |
+                                       ((i & 0x01) ? 0x10 : 0));
+        }
+    }
+};
+static const LahfTable lahf_table;
+
+/*
+    Minimal x86-64 encoder for the handful of instruction forms
+    the recompiler needs. rbx holds the CPU pointer and rbp the
+    LAHF table for the whole block.
+*/
+class Emitter {
+public:
+    std::vector<u8> buf;
+
+    void byte(u8 b) { buf.push_back(b); }
+    void word(u16 w) { byte(static_cast<u8>(w)); byte(static_cast<u8>(w >> 8)); }
+    void dword(uint32_t d) { for (int i = 0; i < 4; i++) byte(static_cast<u8>(d >> (8 * i))); }
+    void qword(uint64_t q) { for (int i = 0; i < 8; i++) byte(static_cast<u8>(q >> (8 * i))); }
+
+    static u8 modrm(u8 mod, int reg, int rm) {
+        return static_cast<u8>((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+    }
+    static u8 rex(int reg, int rm) {
+        return static_cast<u8>(0x40 | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0));
+    }
+
+    // mov r8, [rbx + disp32] / mov [rbx + disp32], r8
+    void load8(int reg, int32_t disp) { byte(rex(reg, 0)); byte(0x8A); byte(modrm(2, reg, 3)); dword(disp); }
+    void store8(int reg, int32_t disp) { byte(rex(reg, 0)); byte(0x88); byte(modrm(2, reg, 3)); dword(disp); }
+
+    void mov8(int dst, int src) { byte(rex(src, dst)); byte(0x88); byte(modrm(3, src, dst)); }
+    void mov8_imm(int dst, u8 imm) { byte(rex(0, dst)); byte(static_cast<u8>(0xB0 + (dst & 7))); byte(imm); }
+
+    // <op> dst8, src8 with op being the x86 "r/m8, r8" opcode byte
+    void alu8(u8 op, int dst, int src) { byte(rex(src, dst)); byte(op); byte(modrm(3, src, dst)); }
+    // 80 /digit ib
+    void alu8_imm(int digit, int dst, u8 imm) { byte(rex(0, dst)); byte(0x80); byte(modrm(3, digit, dst)); byte(imm); }
+    // FE /0 inc, FE /1 dec, F6 /2 not
+    void unary8(u8 op, int digit, int dst) { byte(rex(0, dst)); byte(op); byte(modrm(3, digit, dst)); }
+
+    void rol8_4(int dst) { byte(rex(0, dst)); byte(0xC0); byte(modrm(3, 0, dst)); byte(4); }
+    void test8_imm(int dst, u8 imm) { byte(rex(0, dst)); byte(0xF6); byte(modrm(3, 0, dst)); byte(imm); }
+
+    // bt r9d, 4: guest carry -> x86 CF
+    void carry_in() { byte(0x41); byte(0x0F); byte(0xBA); byte(modrm(3, 4, HOST_F)); byte(4); }
+
+    // al = SM83 Z/H/C from the current x86 flags
+    void flags_to_al() {
+        byte(0x9F);                                 // lahf
+        byte(0x0F); byte(0xB6); byte(0xC4);         // movzx eax, ah
+        byte(0x8A); byte(0x44); byte(0x05); byte(0x00); // mov al, [rbp + rax]
+    }
+    // al = ZF ? 0x80 : 0
+    void zero_to_al() {
+        byte(0x0F); byte(0x94); byte(0xC0);         // sete al
+        byte(0xC0); byte(0xE0); byte(0x07);         // shl al, 7
+    }
+    void al_or(u8 imm) { byte(0x0C); byte(imm); }
+    void al_and(u8 imm) { byte(0x24); byte(imm); }
+    void f_from_al() { alu8(0x88, HOST_F, 0); }     // mov r9b, al
+    void f_or_al() { alu8(0x08, HOST_F, 0); }       // or r9b, al
+
+    // add dword [rbx + disp32], imm32
+    void add_mem32(int32_t disp, uint32_t imm) { byte(0x81); byte(modrm(2, 0, 3)); dword(disp); dword(imm); }
+    // mov word [rbx + disp32], imm16
+    void store16_imm(int32_t disp, u16 imm) { byte(0x66); byte(0xC7); byte(modrm(2, 0, 3)); dword(disp); word(imm); }
+    // inc/dec word [rbx + disp32]
+    void inc16_mem(int32_t disp) { byte(0x66); byte(0xFF); byte(modrm(2, 0, 3)); dword(disp); }
+    void dec16_mem(int32_t disp) { byte(0x66); byte(0xFF); byte(modrm(2, 1, 3)); dword(disp); }
+
+    // Returns the offset of the rel32 to patch
+    size_t jnz32() { byte(0x0F); byte(0x85); size_t at = buf.size(); dword(0); return at; }
+    void patch_rel32(size_t at, size_t target) {
+        uint32_t rel = static_cast<uint32_t>(target - (at + 4));
+        for (int i = 0; i < 4; i++) buf[at + i] = static_cast<u8>(rel >> (8 * i));
+    }
+};
+
+// x86 "r/m8, r8" opcodes and "80 /digit" extensions, in SM83 ALU order:
+// ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+static const u8 alu_opcode[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+static const int alu_digit[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+
+// Flags after an ALU op on A, matching the interpreter's _opcode_* helpers
+static void emit_alu_flags(Emitter& e, uint op) {
+    switch (op) {
+        case 0: case 1:                     // ADD, ADC: Z H C from x86, N = 0
+            e.flags_to_al(); e.f_from_al(); break;
+        case 2: case 3: case 7:             // SUB, SBC, CP: Z H C from x86, N = 1
+            e.flags_to_al(); e.al_or(0x40); e.f_from_al(); break;
+        case 4:                             // AND: Z, H = 1
+            e.zero_to_al(); e.al_or(0x20); e.f_from_al(); break;
+        default:                            // XOR, OR: Z only
+            e.zero_to_al(); e.f_from_al(); break;
+    }
+}
+
+// INC/DEC r: Z and H from x86, carry kept, N set for DEC
+static void emit_incdec_flags(Emitter& e, bool dec) {
+    e.flags_to_al();
+    e.al_and(0xA0);
+    e.alu8_imm(4, HOST_F, 0x10);            // and r9b, 0x10
+    e.f_or_al();
+    if (dec) e.alu8_imm(1, HOST_F, 0x40);   // or r9b, 0x40
+}
+
+/*
+    Emits native code for register-only instructions. Returns false
+    for anything that must go through the interpreter.
+*/
+static bool emit_native(Emitter& e, const DecodedInstruction& in, int32_t disp_sp) {
+    const u8 op = in.opcode;
+
+    if (op == 0x00) return true; // NOP
+
+    // LD rr, nn / LD SP, nn
+    if ((op & 0xCF) == 0x01) {
+        uint pair = op >> 4;
+        if (pair == 3) { e.store16_imm(disp_sp, static_cast<u16>(in.imm[0] | (in.imm[1] << 8))); return true; }
+        e.mov8_imm(host_register[pair * 2 + 1], in.imm[0]);
+        e.mov8_imm(host_register[pair * 2], in.imm[1]);
+        return true;
+    }
+
+    // INC rr / DEC rr (no flags)
+    if ((op & 0xC7) == 0x03) {
+        uint pair = (op >> 4) & 3;
+        bool dec = (op & 0x08) != 0;
+        if (pair == 3) { if (dec) e.dec16_mem(disp_sp); else e.inc16_mem(disp_sp); return true; }
+        int high = host_register[pair * 2];
+        int low = host_register[pair * 2 + 1];
+        e.alu8_imm(dec ? 5 : 0, low, 1);    // sub/add low, 1
+        e.alu8_imm(dec ? 3 : 2, high, 0);   // sbb/adc high, 0
+        return true;
+    }
+
+    // INC r / DEC r / LD r, n
+    if (op < 0x40 && (op & 0x07) >= 0x04 && (op & 0x07) <= 0x06) {
+        int reg = host_register[(op >> 3) & 7];
+        if (reg == NO_HOST) return false;
+
+        switch (op & 0x07) {
+            case 0x04: e.unary8(0xFE, 0, reg); emit_incdec_flags(e, false); return true;
+            case 0x05: e.unary8(0xFE, 1, reg); emit_incdec_flags(e, true); return true;
+            case 0x06: e.mov8_imm(reg, in.imm[0]); return true;
+        }
+    }
+
+    switch (op) {
+        case 0x2F: // CPL
+            e.unary8(0xF6, 2, HOST_A);
+            e.alu8_imm(1, HOST_F, 0x60);
+            return true;
+        case 0x37: // SCF
+            e.alu8_imm(4, HOST_F, 0x80);
+            e.alu8_imm(1, HOST_F, 0x10);
+            return true;
+        case 0x3F: // CCF
+            e.alu8_imm(4, HOST_F, 0x90);
+            e.alu8_imm(6, HOST_F, 0x10);
+            return true;
+    }
+
+    // LD r, r'
+    if (op >= 0x40 && op < 0x80) {
+        int dst = host_register[(op >> 3) & 7];
+        int src = host_register[op & 7];
+        if (dst == NO_HOST || src == NO_HOST) return false;
+        if (dst != src) e.mov8(dst, src);
+        return true;
+    }
+
+    // ALU A, r
+    if (op >= 0x80 && op < 0xC0) {
+        uint alu = (op >> 3) & 7;
+        int src = host_register[op & 7];
+        if (src == NO_HOST) return false;
+        if (alu == 1 || alu == 3) e.carry_in();
+        e.alu8(alu_opcode[alu], HOST_A, src);
+        emit_alu_flags(e, alu);
+        return true;
+    }
+
+    // ALU A, n
+    if (op >= 0xC0 && (op & 0x07) == 0x06) {
+        uint alu = (op >> 3) & 7;
+        if (alu == 1 || alu == 3) e.carry_in();
+        e.alu8_imm(alu_digit[alu], HOST_A, in.imm[0]);
+        emit_alu_flags(e, alu);
+        return true;
+    }
+
+    // CB-prefixed: SWAP, BIT, RES, SET on registers
+    if (op == 0xCB) {
+        const u8 cb = in.imm[0];
+        int reg = host_register[cb & 7];
+        u8 mask = static_cast<u8>(1 << ((cb >> 3) & 7));
+        if (reg == NO_HOST) return false;
+
+        if ((cb & 0xF8) == 0x30) {
+            e.rol8_4(reg);
+            e.test8_imm(reg, 0xFF);
+            e.zero_to_al();
+            e.f_from_al();
+            return true;
+        }
+        if (cb >= 0x40 && cb < 0x80) {
+            e.test8_imm(reg, mask);
+            e.zero_to_al();
+            e.al_or(0x20);
+            e.alu8_imm(4, HOST_F, 0x10);
+            e.f_or_al();
+            return true;
+        }
+        if (cb >= 0x80 && cb < 0xC0) { e.alu8_imm(4, reg, static_cast<u8>(~mask)); return true; }
+        if (cb >= 0xC0) { e.alu8_imm(1, reg, mask); return true; }
+    }
+
+    return false;
+}
+
+// Interpreter ops whose only memory effects are stack pushes of values a
+// re-run recomputes identically, or control flow / IME changes
+static bool stack_or_control(u8 op) {
+    switch (op) {
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:
+        case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+        case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+        case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+        case 0xC5: case 0xD5: case 0xE5: case 0xF5:
+        case 0xF3: case 0xFB: case 0x76:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Jit::verifiable(const DecodedInstruction* instructions, uint count) {
+    Emitter scratch;
+    for (uint i = 0; i < count; i++) {
+        if (!emit_native(scratch, instructions[i], 0) && !stack_or_control(instructions[i].opcode)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Jit::Jit(CPU& inCPU) : cpu(inCPU) {
+#if JIT_SUPPORTED
+#ifdef _WIN32
+    void* mem = VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    void* mem = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) mem = nullptr;
+#endif
+    if (!mem) {
+        log_warn("JIT: could not allocate executable memory, using the cached interpreter");
+        return;
+    }
+    code = static_cast<u8*>(mem);
+    code_size = CODE_BUFFER_SIZE;
+#else
+    log_warn("JIT: only supported on x86-64, using the cached interpreter");
+#endif
+}
+
+Jit::~Jit() {
+#if JIT_SUPPORTED
+    if (!code) return;
+#ifdef _WIN32
+    VirtualFree(code, 0, MEM_RELEASE);
+#else
+    munmap(code, code_size);
+#endif
+#endif
+}
+
+void Jit::reset() {
+    code_used = 0;
+    callout_instructions.clear();
+}
+
+bool Jit::callout(CPU* cpu, const DecodedInstruction* in) {
+    cpu->branch_taken = false;
+    cpu->decoded_imm = in->imm;
+    cpu->pc.set(in->next_pc);
+
+    (cpu->*(in->handler))();
+
+    cpu->decoded_imm = nullptr;
+    cpu->jit_cycles += cpu->branch_taken ? in->cycles_branched : in->cycles;
+    return cpu->block_exit;
+}
+
+jit_block_t Jit::compile(const DecodedInstruction* instructions, uint count) {
+    if (!code || count == 0) return nullptr;
+
+    auto offset = [this](const void* field) {
+        return static_cast<int32_t>(static_cast<const u8*>(field) - reinterpret_cast<const u8*>(&cpu));
+    };
+
+    // Guest register storage, in host register order r8..r15
+    const int32_t disp_reg[8] = {
+        offset(&cpu.a.val), offset(&cpu.f.val), offset(&cpu.b.val), offset(&cpu.c.val),
+        offset(&cpu.d.val), offset(&cpu.e.val), offset(&cpu.h.val), offset(&cpu.l.val),
+    };
+    const int32_t disp_pc = offset(&cpu.pc.val);
+    const int32_t disp_sp = offset(&cpu.sp.val);
+    const int32_t disp_cycles = offset(&cpu.jit_cycles);
+
+    Emitter e;
+    std::vector<size_t> exits;
+
+    auto load_registers = [&]() { for (int r = 0; r < 8; r++) e.load8(8 + r, disp_reg[r]); };
+    auto store_registers = [&]() { for (int r = 0; r < 8; r++) e.store8(8 + r, disp_reg[r]); };
+
+    // Prologue: save callee-saved registers, keep rsp 16-byte aligned with 32 bytes of shadow space
+    e.byte(0x53); e.byte(0x55);                         // push rbx; push rbp
+    e.byte(0x41); e.byte(0x54); e.byte(0x41); e.byte(0x55); // push r12; push r13
+    e.byte(0x41); e.byte(0x56); e.byte(0x41); e.byte(0x57); // push r14; push r15
+    e.byte(0x48); e.byte(0x83); e.byte(0xEC); e.byte(0x28); // sub rsp, 40
+#ifdef _WIN32
+    e.byte(0x48); e.byte(0x89); e.byte(0xCB);           // mov rbx, rcx
+#else
+    e.byte(0x48); e.byte(0x89); e.byte(0xFB);           // mov rbx, rdi
+#endif
+    e.byte(0x48); e.byte(0xBD); e.qword(reinterpret_cast<uint64_t>(lahf_table.flags)); // mov rbp, imm64
+    load_registers();
+
+    uint pending_cycles = 0;
+    bool registers_live = true;
+
+    for (uint i = 0; i < count; i++) {
+        const DecodedInstruction& in = instructions[i];
+
+        if (emit_native(e, in, disp_sp)) {
+            pending_cycles += in.cycles;
+            continue;
+        }
+
+        if (pending_cycles) {
+            e.add_mem32(disp_cycles, pending_cycles);
+            pending_cycles = 0;
+        }
+        store_registers();
+
+        callout_instructions.push_back(in);
+        const DecodedInstruction* stable = &callout_instructions.back();
+
+#ifdef _WIN32
+        e.byte(0x48); e.byte(0x89); e.byte(0xD9);       // mov rcx, rbx
+        e.byte(0x48); e.byte(0xBA); e.qword(reinterpret_cast<uint64_t>(stable)); // mov rdx, imm64
+#else
+        e.byte(0x48); e.byte(0x89); e.byte(0xDF);       // mov rdi, rbx
+        e.byte(0x48); e.byte(0xBE); e.qword(reinterpret_cast<uint64_t>(stable)); // mov rsi, imm64
+#endif
+        e.byte(0x48); e.byte(0xB8); e.qword(reinterpret_cast<uint64_t>(&Jit::callout)); // mov rax, imm64
+        e.byte(0xFF); e.byte(0xD0);                     // call rax
+
+        if (i + 1 == count) {
+            registers_live = false;
+            break;
+        }
+
+        e.byte(0x84); e.byte(0xC0);                     // test al, al
+        exits.push_back(e.jnz32());
+        load_registers();
+    }
+
+    if (registers_live) {
+        if (pending_cycles) e.add_mem32(disp_cycles, pending_cycles);
+        store_registers();
+        e.store16_imm(disp_pc, instructions[count - 1].next_pc);
+    }
+
+    // Epilogue
+    size_t epilogue = e.buf.size();
+    for (size_t at : exits) e.patch_rel32(at, epilogue);
+    e.byte(0x48); e.byte(0x83); e.byte(0xC4); e.byte(0x28); // add rsp, 40
+    e.byte(0x41); e.byte(0x5F); e.byte(0x41); e.byte(0x5E); // pop r15; pop r14
+    e.byte(0x41); e.byte(0x5D); e.byte(0x41); e.byte(0x5C); // pop r13; pop r12
+    e.byte(0x5D); e.byte(0x5B);                         // pop rbp; pop rbx
+    e.byte(0xC3);                                       // ret
+
+    if (code_used + e.buf.size() > code_size) return nullptr;
+
+    u8* entry = code + code_used;
+    std::copy(e.buf.begin(), e.buf.end(), entry);
+    code_used += (e.buf.size() + 15) & ~static_cast<size_t>(15);
+
+    return reinterpret_cast<jit_block_t>(entry);
+}
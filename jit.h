@@ -0,0 +1,60 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "definitions.h"
+#include "block_cache.h"
+
+class CPU;
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+/*
+    x86-64 recompiler for hot basic blocks.
+
+    Guest A, F, B, C, D, E, H, L live in host r8b..r15b for the
+    duration of a block. Register-only instructions are emitted as
+    native code; everything touching memory, I/O or control flow is
+    a call back into the interpreter's opcode handler, with the guest
+    registers spilled around it. Bank switching and self-modifying
+    code are handled by the block cache, which owns the native entry.
+*/
+class Jit {
+public:
+    // Blocks are compiled after running this many times interpreted
+    static const uint HOT_THRESHOLD = 16;
+
+    explicit Jit(CPU& inCPU);
+    ~Jit();
+
+    // False if the platform is unsupported or no executable memory
+    bool available() const { return code != nullptr; }
+
+    // Returns nullptr when out of space; the caller should flush and retry later
+    jit_block_t compile(const DecodedInstruction* instructions, uint count);
+
+    // Whether the block only has effects a second run reproduces exactly
+    // (registers plus stack pushes), so it can be checked against the
+    // interpreter by running it twice
+    static bool verifiable(const DecodedInstruction* instructions, uint count);
+
+    // Drops all native code
+    void reset();
+
+private:
+    static bool callout(CPU* cpu, const DecodedInstruction* in);
+
+    CPU& cpu;
+
+    u8* code = nullptr;
+    size_t code_size = 0;
+    size_t code_used = 0;
+
+    // Stable copies of the instructions handed to callouts
+    std::deque<DecodedInstruction> callout_instructions;
+};
@@ -1,4 +1,5 @@
 #include "joypad.h"
+#include "cpu.h"
 
 u8 Joypad::read() const {
     u8 result = 0xC0 | select_bits | 0x0F;
@@ -41,16 +42,10 @@ void Joypad::set_button(Button button, bool pressed) {
     }
 
     if (target && !(*target) && pressed) {
-        interrupt_requested = true;
+        cpu.request_interrupt(interrupt_bits::joypad);
     }
 
     if (target) {
         *target = pressed;
     }
-}
-
-bool Joypad::consume_interrupt_request() {
-    bool requested = interrupt_requested;
-    interrupt_requested = false;
-    return requested;
 }
\ No newline at end of file
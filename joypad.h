@@ -1,8 +1,12 @@
 #pragma once
 #include "definitions.h"
 
+class CPU;
+
 class Joypad {
 public:
+	explicit Joypad(CPU& inCPU) : cpu(inCPU) {}
+
 	enum class Button {
 		Right, Left, Up, Down,
 		A, B, Select, Start
@@ -13,9 +17,9 @@ public:
 
 	void set_button(Button button, bool pressed);
 
-	bool consume_interrupt_request();
-
 private:
+	CPU& cpu;
+
 	u8 select_bits = 0x30;
 
 	bool right = false;
@@ -27,6 +31,4 @@ private:
 	bool b = false;
 	bool select = false;
 	bool start = false;
-
-	bool interrupt_requested = false;
 };
\ No newline at end of file
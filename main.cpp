@@ -1,10 +1,13 @@
 #include "gameboy.h"
 #include "cli.h"
 #include "files.h"
+#include "rom_loader.h"
 #include "log.h"
 #include "framebuffer.h"
 #include "joypad.h"
+#include "profiler.h"
 
+#include <cstdio>
 #include <iostream>
 #include <vector>
 #define SDL_MAIN_HANDLED
@@ -30,6 +33,7 @@ static SDL_Window* window = nullptr;
 static SDL_Renderer* renderer = nullptr;
 static SDL_Texture* texture = nullptr;
 static bool          quit = false;
+static bool          show_overlay = false;
 
 static bool should_close_callback() {
     SDL_Event e;
@@ -37,6 +41,12 @@ static bool should_close_callback() {
         if (e.type == SDL_QUIT) quit = true;
         if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) quit = true;
 
+        // F1 toggles the frame-time overlay (and starts profiling if needed)
+        if (gb_ptr && e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F1) {
+            show_overlay = !show_overlay;
+            if (show_overlay) gb_ptr->profiler.set_enabled(true);
+        }
+
         if (gb_ptr && (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP)) {
             bool pressed = e.type == SDL_KEYDOWN;
 
@@ -59,9 +69,78 @@ static bool should_close_callback() {
     return quit;
 }
 
-static void vblank_callback(const FrameBuffer& fb) {
+// Stacked bar per recent frame along the bottom of the window, one colour
+// per subsystem, with a line marking the 60fps frame budget.
+static void draw_profile_overlay(const Profiler& profiler) {
+    struct SectionColor { ProfileSection section; Uint8 r, g, b; };
+    static const SectionColor colors[] = {
+        { ProfileSection::CPU,     0x40, 0x80, 0xFF },
+        { ProfileSection::PPU,     0x40, 0xD0, 0x40 },
+        { ProfileSection::Timer,   0xFF, 0xD0, 0x40 },
+        { ProfileSection::Convert, 0xFF, 0x80, 0x20 },
+        { ProfileSection::Present, 0xD0, 0x40, 0xD0 },
+    };
+
+    const int bar_width = 3;
+    const int window_width = GB_WIDTH * SCALE;
+    const int window_height = GB_HEIGHT * SCALE;
+    const double px_per_ns = 8.0 / 1000000.0; // 8px per millisecond
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+
+    auto frames = profiler.history(window_width / bar_width);
+    for (size_t i = 0; i < frames.size(); i++) {
+        int x = static_cast<int>(i) * bar_width;
+        int y = window_height;
+
+        for (const auto& color : colors) {
+            uint64_t ns = frames[i].section_ns[static_cast<uint>(color.section)];
+            int h = static_cast<int>(ns * px_per_ns);
+            if (h <= 0) continue;
+
+            SDL_Rect bar = { x, y - h, bar_width - 1, h };
+            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 0xC0);
+            SDL_RenderFillRect(renderer, &bar);
+            y -= h;
+        }
+    }
+
+    SDL_Rect budget = { 0, window_height - static_cast<int>(16742000 * px_per_ns), window_width, 1 };
+    SDL_SetRenderDrawColor(renderer, 0xFF, 0x20, 0x20, 0xFF);
+    SDL_RenderFillRect(renderer, &budget);
+}
+
+// Writes p50/p99/max per subsystem into the window title (in ms)
+static void update_profile_title(const Profiler& profiler) {
+    static const ProfileSection sections[] = {
+        ProfileSection::CPU, ProfileSection::PPU, ProfileSection::Timer,
+        ProfileSection::Convert, ProfileSection::Present, ProfileSection::Frame,
+    };
+
+    std::string title = "Game Boy Emulator";
+    for (auto section : sections) {
+        ProfileStats stats = profiler.stats(section);
+
+        char part[96];
+        snprintf(part, sizeof(part), " | %s %.2f/%.2f/%.2f",
+                 describe(section).c_str(),
+                 stats.p50_ns / 1e6, stats.p99_ns / 1e6, stats.max_ns / 1e6);
+        title += part;
+    }
+
+    SDL_SetWindowTitle(window, title.c_str());
+}
+
+static void vblank_callback(const FrameBuffer& fb, bool rendered) {
     static int frame_count = 0;
     frame_count++;
+
+    // Frame skipping: the picture hasn't changed, so there's nothing to present
+    if (!rendered) return;
+
+    bool profiling = gb_ptr && gb_ptr->profiler.enabled();
+    uint64_t convert_start = profiling ? Profiler::now_ns() : 0;
+
     static uint32_t pixels[GB_WIDTH * GB_HEIGHT];
     for (int y = 0; y < GB_HEIGHT; y++) {
         for (int x = 0; x < GB_WIDTH; x++) {
@@ -69,20 +148,62 @@ static void vblank_callback(const FrameBuffer& fb) {
         }
     }
 
+    uint64_t present_start = profiling ? Profiler::now_ns() : 0;
+
     SDL_UpdateTexture(texture, nullptr, pixels, GB_WIDTH * sizeof(uint32_t));
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    if (profiling && show_overlay) {
+        draw_profile_overlay(gb_ptr->profiler);
+    }
     SDL_RenderPresent(renderer);
+
+    if (profiling) {
+        gb_ptr->profiler.add(ProfileSection::Convert, present_start - convert_start);
+        gb_ptr->profiler.add(ProfileSection::Present, Profiler::now_ns() - present_start);
+
+        if (show_overlay && frame_count % 60 == 0) {
+            update_profile_title(gb_ptr->profiler);
+        }
+    }
+}
+
+// No window, no rendering and no frame pacing. Reports throughput on its
+// own, as the CPU/MMU ceiling without any video work.
+static int run_headless(const std::vector<u8>& rom_data, Options& options, const std::vector<u8>& save_data) {
+    Gameboy gb(rom_data, options, save_data);
+    gb_ptr = &gb;
+
+    uint frames = 0;
+    const uint64_t start = Profiler::now_ns();
+    gb.run([&]() { return options.frames != 0 && frames >= options.frames; },
+           [&](const FrameBuffer&, bool) { frames++; });
+    const double seconds = (Profiler::now_ns() - start) / 1e9;
+
+    // The DMG draws 4194304 / 70224 = 59.73 frames per second
+    const double fps = seconds > 0 ? frames / seconds : 0;
+    std::printf("Headless: %u frames in %.3f s, %.1f fps (%.1fx real time)\n",
+                frames, seconds, fps, fps / 59.7275);
+
+    if (!options.profile_csv.empty()) gb.profiler.write_csv(options.profile_csv);
+    if (!options.profile_trace.empty()) gb.profiler.write_trace(options.profile_trace);
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
     Options options = get_options(argc, argv);
     options.disable_logs = true;
 
-    auto rom_char = read_bytes(options.filename);
-    if (rom_char.empty()) {
-        std::cerr << "Failed to read ROM: " << options.filename << "\n";
-        return 1;
+    std::vector<u8> rom_data = load_rom(options.filename, options.rom_cache);
+
+    std::vector<u8> save_data;
+    if (!options.save_file.empty() && file_exists(options.save_file)) {
+        auto save_char = read_bytes(options.save_file);
+        save_data.assign(save_char.begin(), save_char.end());
+    }
+
+    if (options.headless) {
+        return run_headless(rom_data, options, save_data);
     }
 
     // Init SDL
@@ -121,13 +242,15 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    std::vector<u8> rom_data(rom_char.begin(), rom_char.end());
-    std::vector<u8> save_data;
     Gameboy gb(rom_data, options, save_data);
     gb_ptr = &gb;
 
+    show_overlay = options.profile;
     gb.run(should_close_callback, vblank_callback);
 
+    if (!options.profile_csv.empty()) gb.profiler.write_csv(options.profile_csv);
+    if (!options.profile_trace.empty()) gb.profiler.write_trace(options.profile_trace);
+
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -4,6 +4,9 @@
 #include "video.h"
 #include "boot.h"
 #include "gameboy.h"
+#include "debugger.h"
+
+#include <algorithm>
 
 MMU::MMU(Cartridge& inCartridge, CPU& inCPU, Video& inVideo, Joypad& inJoypad, Timer& inTimer, Gameboy& inGb)
     : cartridge(inCartridge)
@@ -18,19 +21,24 @@ MMU::MMU(Cartridge& inCartridge, CPU& inCPU, Video& inVideo, Joypad& inJoypad, T
 u8 MMU::read(const Address& address) const {
     u16 addr = address.value();
 
+    if (probing) probe_read(addr);
+    if (page_flags[addr >> 8] & PAGE_WATCH_READ) debugger->on_read(addr);
+    if (dma_blocks(addr)) return 0xFF;
+
+    if (addr < 0x8000) {
+        return cartridge.read_rom(addr);
+    }
+
     if (addr == 0xFF04) return timer.read_div();
     if (addr == 0xFF05) return timer.read_tima();
     if (addr == 0xFF06) return timer.read_tma();
     if (addr == 0xFF07) return timer.read_tac();
 
-    if (addr < 0x8000) {
-        return cartridge.read(address);
-    }
     if (addr < 0xA000) {
         return memory_read(address);
     }
     if (addr < 0xC000) {
-        return memory_read(address);
+        return cartridge.read_ram(addr);
     }
     if (addr < 0xE000) {
         return memory_read(address);
@@ -51,22 +59,32 @@ u8 MMU::read(const Address& address) const {
         return memory_read(address);
     }
     // 0xFFFF = Interrupt Enable register
-    return cpu.interrupt_enabled.value();
+    return cpu.read_interrupt_enable();
 }
 
 void MMU::write(const Address& address, u8 byte) {
     u16 addr = address.value();
 
+    // Echo RAM writes land in WRAM, whose pages carry the code flags
+    const bool echo = addr >= 0xE000 && addr < 0xFE00;
+    if (page_flags[(echo ? addr - 0x2000 : addr) >> 8] & PAGE_CODE) cpu.code_write(addr);
+    if (page_flags[addr >> 8] & PAGE_WATCH_WRITE) debugger->on_write(addr, byte);
+    if (probing) {
+        probe.wrote = true;
+    }
+    if (dma_blocks(addr)) return;
+
     if (addr < 0x8000) {
         cartridge.write(address, byte);
         return;
     }
     else if (addr < 0xA000) {
         memory_write(address, byte);
+        video.log_write(addr, byte);
         return;
     }
     else if (addr < 0xC000) {
-        memory_write(address, byte);
+        cartridge.write_ram(addr, byte);
         return;
     }
     else if (addr < 0xE000) {
@@ -95,9 +113,91 @@ void MMU::write(const Address& address, u8 byte) {
     }
     else {
         // 0xFFFF = Interrupt Enable register
-        cpu.interrupt_enabled.set(byte);
+        cpu.write_interrupt_enable(byte);
+        return;
+    }
+}
+
+uint MMU::rom_bank() const {
+    return cartridge.rom_bank();
+}
+
+uint MMU::low_rom_bank() const {
+    return cartridge.low_rom_bank();
+}
+
+void MMU::set_code_page(u8 page, bool has_code) {
+    // Code run from echo RAM is flagged on the WRAM page it mirrors
+    if (page >= 0xE0 && page < 0xFE) page = u8(page - 0x20);
+    if (has_code) page_flags[page] |= PAGE_CODE;
+    else page_flags[page] &= u8(~PAGE_CODE);
+}
+
+void MMU::set_watch(u16 begin, u16 end, u8 kinds) {
+    u8 flags = 0;
+    if (kinds & watch_kind::read) flags |= PAGE_WATCH_READ;
+    if (kinds & watch_kind::write) flags |= PAGE_WATCH_WRITE;
+    if (kinds & watch_kind::execute) flags |= PAGE_WATCH_EXECUTE;
+    for (uint page = begin >> 8; page <= uint(end >> 8); page++) page_flags[page] |= flags;
+}
+
+void MMU::begin_probe() {
+    probe = Probe();
+    probing = true;
+}
+
+MMU::Probe MMU::end_probe() {
+    probing = false;
+    return probe;
+}
+
+void MMU::probe_read(u16 addr) const {
+    if (addr == 0xFF04) probe.read_div = true;
+    else if (addr == 0xFF05) probe.read_tima = true;
+    else if (addr >= 0xA000 && addr < 0xC000) probe.read_volatile = true;
+}
+
+// Writing 0xFF46 again restarts the transfer from the new page
+void MMU::start_dma(u8 page) {
+    dma_source = u16(page) << 8;
+    dma_remaining = DMA_LENGTH;
+    dma_starting = true;
+    cpu.end_block();
+}
+
+void MMU::step_dma(uint cycles) {
+    // The first tick covers the instruction that wrote 0xFF46
+    if (dma_starting) {
+        dma_starting = false;
         return;
     }
+    const uint done = (DMA_LENGTH - dma_remaining) / CLOCKS_PER_M_CYCLE;
+    dma_remaining -= std::min(cycles, dma_remaining);
+    copy_dma(done, (DMA_LENGTH - dma_remaining) / CLOCKS_PER_M_CYCLE);
+}
+
+// A transfer never crosses its source page, so each region is one bulk copy
+void MMU::copy_dma(uint from, uint to) {
+    u8* oam = &memory[0xFE00];
+    const u16 src = dma_source;
+
+    if (src < 0x8000) {
+        const u8* rom = cartridge.mapped_rom(src);
+        std::copy(rom + from, rom + to, oam + from);
+    }
+    else if (src >= 0xA000 && src < 0xC000) {
+        if (const u8* ram = cartridge.mapped_ram(src)) {
+            std::copy(ram + from, ram + to, oam + from);
+        }
+        else {
+            for (uint i = from; i < to; i++) oam[i] = cartridge.read_ram(u16(src + i));
+        }
+    }
+    else {
+        // Pages 0xE0 and up read the WRAM echo
+        const u16 base = src >= 0xE000 ? u16(src - 0x2000) : src;
+        std::copy(&memory[base + from], &memory[base + to], oam + from);
+    }
 }
 
 bool MMU::boot_rom_active() const {
@@ -111,13 +211,13 @@ u8 MMU::read_io(const Address& address) const {
     if (addr == 0xFF00) return joypad.read();
 
     // Interrupt Flag
-    if (addr == 0xFF0F) return cpu.interrupt_flag.value();
+    if (addr == 0xFF0F) return cpu.read_interrupt_flag();
 
     // LCD registers
     if (addr >= 0xFF40 && addr <= 0xFF4B) {
         switch (addr) {
         case 0xFF40: return video.lcd_control.value();
-        case 0xFF41: return video.lcd_status.value();
+        case 0xFF41: return video.lcd_status.value() | 0x80;
         case 0xFF42: return video.scroll_y.value();
         case 0xFF43: return video.scroll_x.value();
         case 0xFF44: return video.line.value();
@@ -164,28 +264,21 @@ void MMU::write_io(const Address& address, u8 byte) {
 
     // Interrupt Flag
     if (addr == 0xFF0F) {
-        cpu.interrupt_flag.set(byte);
+        cpu.write_interrupt_flag(byte);
         return;
     }
 
     // LCD registers
     if (addr >= 0xFF40 && addr <= 0xFF4B) {
+        video.register_written(addr, byte);
         switch (addr) {
         case 0xFF40: video.lcd_control.set(byte); break;
-        case 0xFF41: video.lcd_status.set(byte); break;
+        case 0xFF41: video.write_stat(byte); break;
         case 0xFF42: video.scroll_y.set(byte); break;
         case 0xFF43: video.scroll_x.set(byte); break;
-        case 0xFF44: video.line.set(0); break;
-        case 0xFF45: video.ly_compare.set(byte); break;
-        case 0xFF46: video.dma_transfer.set(byte); 
-                     {
-                        u16 src = (u16)byte << 8;
-                        for (int i = 0; i < 160; i++) {
-                            u8 val = read(Address(src + i));
-                            write(Address(0xFE00 + i), val);
-                        }
-                     }
-                     break;
+        case 0xFF44: video.reset_line(); break;
+        case 0xFF45: video.write_ly_compare(byte); break;
+        case 0xFF46: video.dma_transfer.set(byte); start_dma(byte); break;
         case 0xFF47: video.bg_palette.set(byte); break;
         case 0xFF48: video.sprite_palette_0.set(byte); break;
         case 0xFF49: video.sprite_palette_1.set(byte); break;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 
 #include "definitions.h"
@@ -9,6 +10,7 @@
 #include "timer.h"
 
 class CPU;
+class Debugger;
 class Gameboy;
 class Video;
 
@@ -25,6 +27,50 @@ public:
 	u8 read(const class Address& address) const;
 	void write(const class Address& address, u8 byte);
 
+	// VRAM and OAM as the PPU sees them, off the CPU bus and so
+	// unaffected by an OAM DMA in progress
+	const u8* video_memory(u16 addr) const { return &memory[addr]; }
+
+	/*
+		OAM DMA: a write to 0xFF46 copies 160 bytes from page XX00
+		into OAM, one byte per M-cycle. While it runs the CPU can only
+		reach HRAM and the I/O registers; everything else reads 0xFF
+		and ignores writes. The copy is done in bulk for however many
+		bytes the elapsed cycles cover.
+	*/
+	static const uint DMA_BYTES = 160;
+	static const uint DMA_LENGTH = DMA_BYTES * CLOCKS_PER_M_CYCLE;
+	void tick_dma(uint cycles) { if (dma_remaining) step_dma(cycles); }
+	bool dma_active() const { return dma_remaining != 0; }
+	uint dma_cycles_remaining() const { return dma_remaining; }
+
+	// Currently mapped banks at 0x4000..0x7FFF and 0x0000..0x3FFF
+	uint rom_bank() const;
+	uint low_rom_bank() const;
+
+	// Writes to pages marked as holding cached code are reported to the CPU
+	void set_code_page(u8 page, bool has_code);
+
+	// Flags the pages covering [begin, end] so accesses of the given
+	// watch_kind reach the debugger; other pages never see it
+	void set_debugger(Debugger* inDebugger) { debugger = inDebugger; }
+	void set_watch(u16 begin, u16 end, u8 kinds);
+	bool execute_watched(u16 addr) const { return (page_flags[addr >> 8] & PAGE_WATCH_EXECUTE) != 0; }
+
+	/*
+		Idle-loop probe: what the CPU touched between begin_probe()
+		and end_probe(). Only reads whose value can change without a
+		CPU write are noted.
+	*/
+	struct Probe {
+		bool wrote = false;
+		bool read_div = false;
+		bool read_tima = false;
+		bool read_volatile = false; // cartridge RAM, which may be a clock
+	};
+	void begin_probe();
+	Probe end_probe();
+
 private:
 	// If there's a boot ROM, we might check wether its still active?
 	bool boot_rom_active() const;
@@ -37,6 +83,14 @@ private:
 	u8 memory_read(const class Address& address) const;
 	void memory_write(const class Address& address, u8 byte);
 
+	void probe_read(u16 addr) const;
+
+	void start_dma(u8 page);
+	void step_dma(uint cycles);
+	// Copies OAM bytes [from, to) of the current transfer
+	void copy_dma(uint from, uint to);
+	bool dma_blocks(u16 addr) const { return dma_remaining && addr < 0xFF00; }
+
 private:
 	Cartridge& cartridge;
 	CPU& cpu;
@@ -46,4 +100,19 @@ private:
 	Gameboy& gameboy;
 
 	std::vector<u8> memory;
+
+	// Per 256-byte page; an access to a page with no flags takes no detour
+	static const u8 PAGE_CODE          = 0x01;
+	static const u8 PAGE_WATCH_READ    = 0x02;
+	static const u8 PAGE_WATCH_WRITE   = 0x04;
+	static const u8 PAGE_WATCH_EXECUTE = 0x08;
+	std::array<u8, 0x100> page_flags = {};
+	Debugger* debugger = nullptr;
+
+	u16 dma_source = 0;
+	uint dma_remaining = 0;
+	bool dma_starting = false;
+
+	bool probing = false;
+	mutable Probe probe;
 };
\ No newline at end of file
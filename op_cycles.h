@@ -4,6 +4,8 @@
 
 #include "definitions.h"
 
+// In machine cycles, as documented; scaled by CLOCKS_PER_M_CYCLE when used
+
 const std::array<u8, 256> opcode_cycles = {
     1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
     1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+
+#include "definitions.h"
+
+/*
+    Instruction length in bytes (opcode + immediates), matching what each
+    opcode handler consumes through get_byte_from_pc. STOP reads no operand
+    here, and 0xCB is the prefix of a two-byte CB instruction.
+*/
+const std::array<u8, 256> opcode_lengths = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+    1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+};
+
+/*
+    Opcodes that end a basic block: anything that changes control flow,
+    the interrupt master enable, or stops the CPU.
+*/
+inline bool opcode_ends_block(u8 opcode) {
+    switch (opcode) {
+        case 0x10: case 0x76:                                   // STOP, HALT
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:  // JR
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:  // JP
+        case 0xE9:                                              // JP (HL)
+        case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:  // CALL
+        case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8:  // RET
+        case 0xD9:                                              // RETI
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF:             // RST
+        case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+        case 0xF3: case 0xFB:                                   // DI, EI
+            return true;
+        default:
+            return false;
+    }
+}
@@ -268,6 +268,7 @@ void CPU::opcode_dec(Address&& addr) {
 void CPU::opcode_di() {
     interrupts_enabled = false;
     ei_pending = false;
+    update_pending_interrupts();
 }
 
 
@@ -0,0 +1,196 @@
+#include <chrono>
+#include <fstream>
+
+#include "profiler.h"
+#include "log.h"
+
+std::string describe(ProfileSection section) {
+    switch (section) {
+        case ProfileSection::CPU:     return "CPU";
+        case ProfileSection::PPU:     return "PPU";
+        case ProfileSection::Timer:   return "Timer";
+        case ProfileSection::Convert: return "Convert";
+        case ProfileSection::Present: return "Present";
+        case ProfileSection::Frame:   return "Frame";
+    }
+    return "Unknown";
+}
+
+/* Histogram */
+uint Histogram::bucket_index(uint64_t ns) {
+    if (ns < SUB_BUCKETS) return static_cast<uint>(ns);
+
+    uint exponent = 4;
+    while ((ns >> (exponent + 1)) != 0) exponent++;
+
+    uint mantissa = static_cast<uint>(ns >> (exponent - 4)) & (SUB_BUCKETS - 1);
+    uint index = (exponent - 3) * SUB_BUCKETS + mantissa;
+    return index < BUCKETS ? index : BUCKETS - 1;
+}
+
+uint64_t Histogram::bucket_value(uint index) {
+    if (index < SUB_BUCKETS) return index;
+
+    uint exponent = index / SUB_BUCKETS + 3;
+    uint64_t mantissa = index % SUB_BUCKETS;
+    return (SUB_BUCKETS + mantissa) << (exponent - 4);
+}
+
+void Histogram::add(uint64_t ns) {
+    buckets[bucket_index(ns)]++;
+    total++;
+    if (ns > max_ns) max_ns = ns;
+}
+
+void Histogram::reset() {
+    buckets.fill(0);
+    total = 0;
+    max_ns = 0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (total == 0) return 0;
+
+    uint64_t wanted = static_cast<uint64_t>(p * static_cast<double>(total));
+    if (wanted >= total) wanted = total - 1;
+
+    uint64_t seen = 0;
+    for (uint i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > wanted) {
+            uint64_t value = bucket_value(i);
+            return value < max_ns ? value : max_ns;
+        }
+    }
+    return max_ns;
+}
+
+/* Profiler */
+uint64_t Profiler::now_ns() {
+    using namespace std::chrono;
+    return static_cast<uint64_t>(
+        duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+void Profiler::set_enabled(bool enable) {
+    if (enable && !is_enabled) {
+        reset();
+    }
+    is_enabled = enable;
+}
+
+void Profiler::reset() {
+    epoch_ns = now_ns();
+    frame_count = 0;
+    current = FrameRecord();
+    for (auto& histogram : histograms) histogram.reset();
+    history_head = 0;
+    history_size = 0;
+}
+
+void Profiler::begin_frame() {
+    current = FrameRecord();
+    current.frame = frame_count;
+    current.start_ns = now_ns() - epoch_ns;
+}
+
+void Profiler::add(ProfileSection section, uint64_t ns) {
+    current.section_ns[static_cast<uint>(section)] += ns;
+}
+
+void Profiler::end_frame() {
+    for (uint i = 0; i < PROFILE_SECTION_COUNT; i++) {
+        histograms[i].add(current.section_ns[i]);
+    }
+
+    frames[history_head] = current;
+    history_head = (history_head + 1) % HISTORY_FRAMES;
+    if (history_size < HISTORY_FRAMES) history_size++;
+
+    frame_count++;
+}
+
+ProfileStats Profiler::stats(ProfileSection section) const {
+    const Histogram& histogram = histograms[static_cast<uint>(section)];
+
+    ProfileStats result;
+    result.p50_ns = histogram.percentile(0.50);
+    result.p99_ns = histogram.percentile(0.99);
+    result.max_ns = histogram.max();
+    result.count  = histogram.count();
+    return result;
+}
+
+std::vector<FrameRecord> Profiler::history(uint max_frames) const {
+    uint n = max_frames < history_size ? max_frames : history_size;
+
+    std::vector<FrameRecord> result;
+    result.reserve(n);
+
+    uint start = (history_head + HISTORY_FRAMES - n) % HISTORY_FRAMES;
+    for (uint i = 0; i < n; i++) {
+        result.push_back(frames[(start + i) % HISTORY_FRAMES]);
+    }
+    return result;
+}
+
+bool Profiler::write_csv(const std::string& filename) const {
+    std::ofstream out(filename);
+    if (!out.good()) {
+        log_error("Cannot write profile CSV: %s", filename.c_str());
+        return false;
+    }
+
+    out << "frame,start_us";
+    for (uint i = 0; i < PROFILE_SECTION_COUNT; i++) {
+        out << "," << describe(static_cast<ProfileSection>(i)) << "_us";
+    }
+    out << "\n";
+
+    for (const auto& record : history()) {
+        out << record.frame << "," << record.start_ns / 1000.0;
+        for (uint64_t ns : record.section_ns) {
+            out << "," << ns / 1000.0;
+        }
+        out << "\n";
+    }
+
+    return out.good();
+}
+
+// Chrome trace-event format (chrome://tracing, Perfetto). The subsystems
+// are interleaved per instruction, so inside each frame they are laid out
+// back to back as an aggregate rather than at their real start times.
+bool Profiler::write_trace(const std::string& filename) const {
+    std::ofstream out(filename);
+    if (!out.good()) {
+        log_error("Cannot write profile trace: %s", filename.c_str());
+        return false;
+    }
+
+    const uint frame_index = static_cast<uint>(ProfileSection::Frame);
+    bool first = true;
+
+    auto write_event = [&](const std::string& name, uint64_t start_ns, uint64_t dur_ns, uint tid) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+            << ",\"ts\":" << start_ns / 1000.0 << ",\"dur\":" << dur_ns / 1000.0 << "}";
+    };
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const auto& record : history()) {
+        write_event("Frame " + std::to_string(record.frame), record.start_ns,
+                    record.section_ns[frame_index], 1);
+
+        uint64_t offset = record.start_ns;
+        for (uint i = 0; i < PROFILE_SECTION_COUNT; i++) {
+            if (i == frame_index) continue;
+            write_event(describe(static_cast<ProfileSection>(i)), offset, record.section_ns[i], 2);
+            offset += record.section_ns[i];
+        }
+    }
+    out << "\n]}\n";
+
+    return out.good();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+
+/*
+    Host-side frame timing. Each emulated frame records how much
+    wall time went to each subsystem, which feeds fixed-size
+    histograms (p50/p99/max) and a short history for export.
+*/
+
+enum class ProfileSection {
+    CPU,
+    PPU,
+    Timer,
+    Convert,    // frontend framebuffer -> pixel conversion
+    Present,    // frontend texture upload + present
+    Frame,      // the whole frame, excluding the throttling sleep
+};
+
+const uint PROFILE_SECTION_COUNT = 6;
+
+std::string describe(ProfileSection section);
+
+struct ProfileStats {
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t count = 0;
+};
+
+struct FrameRecord {
+    uint64_t frame = 0;
+    uint64_t start_ns = 0;  // relative to when profiling started
+    std::array<uint64_t, PROFILE_SECTION_COUNT> section_ns = {};
+};
+
+/*
+    Log-linear histogram: 16 buckets per power of two, so any
+    recorded value is within ~6% of its bucket. Never allocates.
+*/
+class Histogram {
+public:
+    void add(uint64_t ns);
+    void reset();
+
+    uint64_t percentile(double p) const;
+    uint64_t max() const { return max_ns; }
+    uint64_t count() const { return total; }
+
+private:
+    static const uint SUB_BUCKETS = 16;
+    static const uint BUCKETS = 40 * SUB_BUCKETS;
+
+    static uint bucket_index(uint64_t ns);
+    static uint64_t bucket_value(uint index);
+
+    std::array<uint32_t, BUCKETS> buckets = {};
+    uint64_t total = 0;
+    uint64_t max_ns = 0;
+};
+
+class Profiler {
+public:
+    static const uint HISTORY_FRAMES = 1024;
+
+    void set_enabled(bool enable);
+    bool enabled() const { return is_enabled; }
+
+    // Current host time in nanoseconds (steady clock).
+    static uint64_t now_ns();
+
+    void begin_frame();
+    void add(ProfileSection section, uint64_t ns);
+    void end_frame();
+
+    void reset();
+
+    ProfileStats stats(ProfileSection section) const;
+
+    // Up to HISTORY_FRAMES most recent frames, oldest first.
+    std::vector<FrameRecord> history(uint max_frames = HISTORY_FRAMES) const;
+
+    bool write_csv(const std::string& filename) const;
+    bool write_trace(const std::string& filename) const;
+
+private:
+    bool is_enabled = false;
+
+    uint64_t epoch_ns = 0;
+    uint64_t frame_count = 0;
+    FrameRecord current;
+
+    std::array<Histogram, PROFILE_SECTION_COUNT> histograms;
+
+    std::array<FrameRecord, HISTORY_FRAMES> frames;
+    uint history_head = 0;
+    uint history_size = 0;
+};
@@ -20,6 +20,7 @@ public:
     auto operator==(u8 other) const -> bool;
 
 protected:
+    friend class Jit; // native blocks address the value directly
     u8 val = 0x0;
 };
 
@@ -75,6 +76,7 @@ public:
     void decrement();
 
 private:
+    friend class Jit;
     u16 val = 0x0;
 };
 
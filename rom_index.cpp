@@ -0,0 +1,276 @@
+#include "rom_index.h"
+#include "cartridge_info.h"
+#include "files.h"
+#include "rom_loader.h"
+#include "log.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+const char MAGIC[4] = { 'G', 'B', 'I', 'X' };
+const uint32_t FORMAT_VERSION = 2;
+const size_t HEADER_SIZE = 16;
+const size_t RECORD_SIZE = 48;
+const size_t SHA1_ENTRY_SIZE = 4;
+
+// Record layout
+const size_t CRC32_AT = 0;
+const size_t SHA1_AT = 4;
+const size_t ROM_SIZE_AT = 24;
+const size_t PATH_OFFSET_AT = 28;
+const size_t TITLE_OFFSET_AT = 32;
+const size_t PATH_LENGTH_AT = 36;
+const size_t TITLE_LENGTH_AT = 38;
+const size_t TYPE_AT = 39;
+const size_t ROM_CODE_AT = 40;
+const size_t RAM_CODE_AT = 41;
+const size_t VERSION_AT = 42;
+const size_t FLAGS_AT = 43;
+const size_t HEADER_CHECKSUM_AT = 44;
+const size_t GLOBAL_CHECKSUM_AT = 46;
+
+const size_t MIN_ROM_SIZE = 0x150;
+
+void put(std::vector<u8>& out, size_t at, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) out[at + i] = u8(value >> (8 * i));
+}
+
+uint32_t get(const u8* p, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) value |= uint32_t(p[i]) << (8 * i);
+    return value;
+}
+
+bool sha1_less(const u8* a, const u8* b) {
+    return std::lexicographical_compare(a, a + SHA1_SIZE, b, b + SHA1_SIZE);
+}
+
+bool sha1_equal(const u8* a, const u8* b) {
+    return std::equal(a, a + SHA1_SIZE, b);
+}
+
+}
+
+bool index_rom(const std::string& path, RomIndexEntry& entry) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.good()) return false;
+    const std::vector<u8> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<u8> rom;
+    if (!decompress_rom(file, rom) || rom.size() < MIN_ROM_SIZE) return false;
+
+    const auto info = get_info(rom);
+
+    entry.crc32 = crc32(rom.data(), rom.size());
+    sha1(rom.data(), rom.size(), entry.sha1);
+    entry.rom_size = uint32_t(rom.size());
+    entry.cartridge_type = rom[header::cartridge_type];
+    entry.rom_size_code = rom[header::rom_size];
+    entry.ram_size_code = rom[header::ram_size];
+    entry.version = info->version;
+    entry.header_checksum = u8(info->header_checksum);
+    entry.global_checksum = info->global_checksum;
+
+    entry.flags = 0;
+    if (info->supports_cgb) entry.flags |= index_flags::cgb;
+    if (rom[header::cgb_flag] == 0xC0) entry.flags |= index_flags::cgb_only;
+    if (info->supports_sgb) entry.flags |= index_flags::sgb;
+    if (compute_header_checksum(rom) == info->header_checksum) entry.flags |= index_flags::header_ok;
+    if (compute_global_checksum(rom) == info->global_checksum) entry.flags |= index_flags::global_ok;
+
+    entry.title = info->title;
+    entry.path = path;
+    return true;
+}
+
+void sort_index(std::vector<RomIndexEntry>& entries) {
+    std::sort(entries.begin(), entries.end(), [](const RomIndexEntry& a, const RomIndexEntry& b) {
+        if (a.crc32 != b.crc32) return a.crc32 < b.crc32;
+        if (!sha1_equal(a.sha1, b.sha1)) return sha1_less(a.sha1, b.sha1);
+        return a.path < b.path;
+    });
+}
+
+bool write_index(const std::string& filename, const std::vector<RomIndexEntry>& entries) {
+    const size_t sha1_offset = HEADER_SIZE + RECORD_SIZE * entries.size();
+    std::vector<u8> out(sha1_offset + SHA1_ENTRY_SIZE * entries.size());
+    std::string strings;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const RomIndexEntry& e = entries[i];
+        const size_t at = HEADER_SIZE + RECORD_SIZE * i;
+        const std::string path = e.path.substr(0, 0xFFFF);
+        const std::string title = e.title.substr(0, 0xFF);
+
+        put(out, at + CRC32_AT, e.crc32, 4);
+        std::copy(e.sha1, e.sha1 + SHA1_SIZE, out.begin() + at + SHA1_AT);
+        put(out, at + ROM_SIZE_AT, e.rom_size, 4);
+        put(out, at + PATH_OFFSET_AT, uint32_t(strings.size()), 4);
+        strings += path;
+        put(out, at + TITLE_OFFSET_AT, uint32_t(strings.size()), 4);
+        strings += title;
+        put(out, at + PATH_LENGTH_AT, uint32_t(path.size()), 2);
+        out[at + TITLE_LENGTH_AT] = u8(title.size());
+        out[at + TYPE_AT] = e.cartridge_type;
+        out[at + ROM_CODE_AT] = e.rom_size_code;
+        out[at + RAM_CODE_AT] = e.ram_size_code;
+        out[at + VERSION_AT] = e.version;
+        out[at + FLAGS_AT] = e.flags;
+        out[at + HEADER_CHECKSUM_AT] = e.header_checksum;
+        put(out, at + GLOBAL_CHECKSUM_AT, e.global_checksum, 2);
+    }
+
+    std::vector<uint32_t> by_sha1(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) by_sha1[i] = uint32_t(i);
+    std::stable_sort(by_sha1.begin(), by_sha1.end(), [&](uint32_t a, uint32_t b) {
+        return sha1_less(entries[a].sha1, entries[b].sha1);
+    });
+    for (size_t i = 0; i < by_sha1.size(); i++) {
+        put(out, sha1_offset + SHA1_ENTRY_SIZE * i, by_sha1[i], 4);
+    }
+
+    std::copy(MAGIC, MAGIC + 4, out.begin());
+    put(out, 4, FORMAT_VERSION, 4);
+    put(out, 8, uint32_t(entries.size()), 4);
+    put(out, 12, uint32_t(strings.size()), 4);
+    out.insert(out.end(), strings.begin(), strings.end());
+
+    return write_file_atomic(filename, out);
+}
+
+bool RomIndex::load(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.good()) {
+        log_error("Cannot open index %s", filename.c_str());
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    count = 0;
+
+    if (data.size() < HEADER_SIZE || !std::equal(MAGIC, MAGIC + 4, data.begin())
+        || get(&data[4], 4) != FORMAT_VERSION) {
+        log_error("%s is not a ROM index", filename.c_str());
+        return false;
+    }
+
+    // Sizes are checked by division first, so a huge count can't wrap.
+    // Records are checked as they are read, so loading stays O(1).
+    const size_t records = get(&data[8], 4);
+    const size_t strings = get(&data[12], 4);
+    if (records > (data.size() - HEADER_SIZE) / (RECORD_SIZE + SHA1_ENTRY_SIZE)
+        || strings > data.size() - HEADER_SIZE - (RECORD_SIZE + SHA1_ENTRY_SIZE) * records) {
+        log_error("ROM index %s is truncated", filename.c_str());
+        return false;
+    }
+    count = records;
+    sha1_offset = HEADER_SIZE + RECORD_SIZE * count;
+    strings_offset = sha1_offset + SHA1_ENTRY_SIZE * count;
+    strings_size = strings;
+    return true;
+}
+
+const u8* RomIndex::record(size_t i) const {
+    return &data[HEADER_SIZE + RECORD_SIZE * i];
+}
+
+bool RomIndex::entry(size_t i, RomIndexEntry& e) const {
+    const u8* r = record(i);
+    const char* strings = reinterpret_cast<const char*>(data.data() + strings_offset);
+
+    const size_t path_offset = get(r + PATH_OFFSET_AT, 4);
+    const size_t title_offset = get(r + TITLE_OFFSET_AT, 4);
+    if (path_offset > strings_size || get(r + PATH_LENGTH_AT, 2) > strings_size - path_offset
+        || title_offset > strings_size || r[TITLE_LENGTH_AT] > strings_size - title_offset) {
+        log_error("ROM index is corrupt at record %u", uint(i));
+        return false;
+    }
+
+    e.crc32 = get(r + CRC32_AT, 4);
+    std::copy(r + SHA1_AT, r + SHA1_AT + SHA1_SIZE, e.sha1);
+    e.rom_size = get(r + ROM_SIZE_AT, 4);
+    e.path.assign(strings + path_offset, get(r + PATH_LENGTH_AT, 2));
+    e.title.assign(strings + title_offset, r[TITLE_LENGTH_AT]);
+    e.cartridge_type = r[TYPE_AT];
+    e.rom_size_code = r[ROM_CODE_AT];
+    e.ram_size_code = r[RAM_CODE_AT];
+    e.version = r[VERSION_AT];
+    e.flags = r[FLAGS_AT];
+    e.header_checksum = r[HEADER_CHECKSUM_AT];
+    e.global_checksum = u16(get(r + GLOBAL_CHECKSUM_AT, 2));
+    return true;
+}
+
+// A record number past the end is clamped, so a corrupt table can only
+// make lookups miss
+size_t RomIndex::sha1_record(size_t i) const {
+    const size_t r = get(&data[sha1_offset + SHA1_ENTRY_SIZE * i], 4);
+    return std::min(r, count - 1);
+}
+
+size_t RomIndex::lower_bound(uint32_t crc) const {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (get(record(mid) + CRC32_AT, 4) < crc) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t RomIndex::lower_bound_sha1(const u8 digest[SHA1_SIZE]) const {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (sha1_less(record(sha1_record(mid)) + SHA1_AT, digest)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+std::vector<RomIndexEntry> RomIndex::find_crc32(uint32_t crc) const {
+    std::vector<RomIndexEntry> found;
+    RomIndexEntry e;
+    for (size_t i = lower_bound(crc); i < count && get(record(i) + CRC32_AT, 4) == crc; i++) {
+        if (entry(i, e)) found.push_back(e);
+    }
+    return found;
+}
+
+std::vector<RomIndexEntry> RomIndex::find_sha1(const u8 digest[SHA1_SIZE]) const {
+    std::vector<RomIndexEntry> found;
+    RomIndexEntry e;
+    for (size_t i = lower_bound_sha1(digest); i < count; i++) {
+        const size_t r = sha1_record(i);
+        if (!sha1_equal(record(r) + SHA1_AT, digest)) break;
+        if (entry(r, e)) found.push_back(e);
+    }
+    return found;
+}
+
+std::string describe_sha1(const u8 digest[SHA1_SIZE]) {
+    static const char hex[] = "0123456789abcdef";
+    std::string s;
+    for (size_t i = 0; i < SHA1_SIZE; i++) {
+        s += hex[digest[i] >> 4];
+        s += hex[digest[i] & 0xF];
+    }
+    return s;
+}
+
+bool parse_sha1(const std::string& hex, u8 digest[SHA1_SIZE]) {
+    if (hex.size() != SHA1_SIZE * 2) return false;
+    for (size_t i = 0; i < hex.size(); i++) {
+        const char c = hex[i];
+        int v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else return false;
+        if (i % 2 == 0) digest[i / 2] = u8(v << 4);
+        else digest[i / 2] |= u8(v);
+    }
+    return true;
+}
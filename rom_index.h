@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+#include "checksum.h"
+
+/*
+    ROM library index, as written by gb-index.
+
+    The file is a 16-byte header ("GBIX", version, entry count, string
+    table size), fixed 48-byte records sorted by CRC-32 then SHA-1, a
+    table of 32-bit record numbers in SHA-1 order, and a string table
+    with the titles and paths. Lookups binary search the records or the
+    SHA-1 table in place, and only the records they return are checked,
+    so a query costs a file read and a few compares.
+*/
+
+namespace index_flags {
+    const u8 cgb        = 0x01;
+    const u8 cgb_only   = 0x02;
+    const u8 sgb        = 0x04;
+    const u8 header_ok  = 0x08;  // header checksum matches
+    const u8 global_ok  = 0x10;  // global checksum matches
+}
+
+struct RomIndexEntry {
+    uint32_t crc32 = 0;
+    u8 sha1[SHA1_SIZE] = {};
+    uint32_t rom_size = 0;
+
+    // Raw header codes, see cartridge_info.h for their meaning
+    u8 cartridge_type = 0;
+    u8 rom_size_code = 0;
+    u8 ram_size_code = 0;
+    u8 version = 0;
+    u8 flags = 0;
+    u8 header_checksum = 0;
+    u16 global_checksum = 0;
+
+    std::string title;
+    std::string path;
+};
+
+// Reads, decompresses and hashes one ROM; false if it isn't one
+bool index_rom(const std::string& path, RomIndexEntry& entry);
+
+void sort_index(std::vector<RomIndexEntry>& entries);
+bool write_index(const std::string& filename, const std::vector<RomIndexEntry>& entries);
+
+class RomIndex {
+public:
+    bool load(const std::string& filename);
+
+    size_t size() const { return count; }
+    // False (and logged) if the record's strings lie outside the table
+    bool entry(size_t i, RomIndexEntry& e) const;
+
+    std::vector<RomIndexEntry> find_crc32(uint32_t crc) const;
+    std::vector<RomIndexEntry> find_sha1(const u8 digest[SHA1_SIZE]) const;
+
+private:
+    const u8* record(size_t i) const;
+    // Record number at position i of the SHA-1 table
+    size_t sha1_record(size_t i) const;
+    // First record whose CRC-32 is not less than `crc`
+    size_t lower_bound(uint32_t crc) const;
+    // First SHA-1 table position whose digest is not less than `digest`
+    size_t lower_bound_sha1(const u8 digest[SHA1_SIZE]) const;
+
+    std::vector<u8> data;
+    size_t count = 0;
+    size_t sha1_offset = 0;
+    size_t strings_offset = 0;
+    size_t strings_size = 0;
+};
+
+std::string describe_sha1(const u8 digest[SHA1_SIZE]);
+// Accepts 40 hex digits; false otherwise
+bool parse_sha1(const std::string& hex, u8 digest[SHA1_SIZE]);
@@ -0,0 +1,290 @@
+#include "rom_loader.h"
+#include "cartridge_info.h"
+#include "checksum.h"
+#include "files.h"
+#include "inflate.h"
+#include "log.h"
+
+#include <algorithm>
+
+#ifdef GB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+const size_t MIN_ROM_SIZE = 0x150;  // up to the end of the header
+const size_t MAX_ROM_SIZE = 8 * 1024 * 1024;
+
+uint32_t get_u32(const u8* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint get_u16(const u8* p) {
+    return p[0] | (p[1] << 8);
+}
+
+bool ends_with(const std::string& s, const std::string& suffix) {
+    if (s.size() < suffix.size()) return false;
+    for (size_t i = 0; i < suffix.size(); i++) {
+        char c = s[s.size() - suffix.size() + i];
+        if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+        if (c != suffix[i]) return false;
+    }
+    return true;
+}
+
+bool decompress_gzip(const std::vector<u8>& in, std::vector<u8>& out) {
+    const u8 FHCRC = 0x02, FEXTRA = 0x04, FNAME = 0x08, FCOMMENT = 0x10;
+
+    if (in.size() < 18 || in[2] != 8) {
+        log_error("Not a deflate gzip stream");
+        return false;
+    }
+    const u8 flags = in[3];
+    size_t pos = 10;
+    if (flags & FEXTRA) pos += 2 + get_u16(&in[pos]);
+    if (flags & FNAME) while (pos < in.size() && in[pos++]) {}
+    if (flags & FCOMMENT) while (pos < in.size() && in[pos++]) {}
+    if (flags & FHCRC) pos += 2;
+    if (pos + 8 > in.size()) return false;
+
+    // ISIZE is the size mod 2^32; only trusted as a hint up to MAX_ROM_SIZE
+    const uint32_t expected_crc = get_u32(&in[in.size() - 8]);
+    out.reserve(std::min<size_t>(get_u32(&in[in.size() - 4]), MAX_ROM_SIZE));
+
+    size_t used = 0;
+    if (!inflate(&in[pos], in.size() - pos, out, MAX_ROM_SIZE, &used)) return false;
+
+    if (crc32(out.data(), out.size()) != expected_crc) {
+        log_error("gzip CRC mismatch");
+        return false;
+    }
+    return true;
+}
+
+/*
+    Takes the first .gb/.gbc entry (or the first file) from the
+    central directory. Only stored and deflated entries are handled,
+    and no zip64, which no ROM needs.
+*/
+bool decompress_zip(const std::vector<u8>& in, std::vector<u8>& out) {
+    const uint32_t END_OF_DIRECTORY = 0x06054b50;
+    const uint32_t DIRECTORY_ENTRY = 0x02014b50;
+    const uint32_t LOCAL_HEADER = 0x04034b50;
+
+    // The end record sits in the last 22 + 65535 (comment) bytes
+    if (in.size() < 22) return false;
+    size_t end = in.size() - 22;
+    const size_t limit = in.size() > 22 + 0xFFFF ? in.size() - 22 - 0xFFFF : 0;
+    while (get_u32(&in[end]) != END_OF_DIRECTORY) {
+        if (end == limit) {
+            log_error("No zip end of central directory record");
+            return false;
+        }
+        end--;
+    }
+
+    const uint entries = get_u16(&in[end + 10]);
+    size_t pos = get_u32(&in[end + 16]);
+
+    size_t chosen = 0;
+    bool found = false;
+    for (uint i = 0; i < entries; i++) {
+        if (pos + 46 > in.size() || get_u32(&in[pos]) != DIRECTORY_ENTRY) return false;
+        const uint name_length = get_u16(&in[pos + 28]);
+        const uint extra_length = get_u16(&in[pos + 30]);
+        const uint comment_length = get_u16(&in[pos + 32]);
+        if (pos + 46 + name_length > in.size()) return false;
+        const std::string name(reinterpret_cast<const char*>(&in[pos + 46]), name_length);
+
+        const bool is_rom = ends_with(name, ".gb") || ends_with(name, ".gbc");
+        const bool is_file = !name.empty() && name.back() != '/';
+        if (is_rom || (is_file && !found)) {
+            chosen = pos;
+            found = true;
+            if (is_rom) break;
+        }
+        pos += 46 + name_length + extra_length + comment_length;
+    }
+    if (!found) {
+        log_error("Zip archive has no files");
+        return false;
+    }
+
+    const uint method = get_u16(&in[chosen + 10]);
+    const uint32_t expected_crc = get_u32(&in[chosen + 16]);
+    const size_t compressed_size = get_u32(&in[chosen + 20]);
+    const size_t size = get_u32(&in[chosen + 24]);
+    const size_t local = get_u32(&in[chosen + 42]);
+
+    if (local + 30 > in.size() || get_u32(&in[local]) != LOCAL_HEADER) return false;
+    const size_t data = local + 30 + get_u16(&in[local + 26]) + get_u16(&in[local + 28]);
+    if (data + compressed_size > in.size()) return false;
+    if (size > MAX_ROM_SIZE) {
+        log_error("Zip entry is %u bytes, more than any ROM", uint(size));
+        return false;
+    }
+
+    out.reserve(size);
+    if (method == 0) {
+        out.assign(in.begin() + data, in.begin() + data + compressed_size);
+    }
+    else if (method == 8) {
+        if (!inflate(&in[data], compressed_size, out, MAX_ROM_SIZE)) return false;
+    }
+    else {
+        log_error("Unsupported zip compression method %u", method);
+        return false;
+    }
+
+    if (out.size() != size || crc32(out.data(), out.size()) != expected_crc) {
+        log_error("Zip entry CRC or size mismatch");
+        return false;
+    }
+    return true;
+}
+
+bool decompress_zstd(const std::vector<u8>& in, std::vector<u8>& out) {
+#ifdef GB_HAVE_ZSTD
+    // Stream so frames without a content size in the header work too
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    ZSTD_initDStream(stream);
+
+    const unsigned long long size = ZSTD_getFrameContentSize(in.data(), in.size());
+    if (size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR)
+        out.reserve(std::min<size_t>(size, MAX_ROM_SIZE));
+
+    std::vector<u8> chunk(ZSTD_DStreamOutSize());
+    ZSTD_inBuffer input = { in.data(), in.size(), 0 };
+    size_t result;
+    bool full;
+    do {
+        ZSTD_outBuffer output = { chunk.data(), chunk.size(), 0 };
+        result = ZSTD_decompressStream(stream, &output, &input);
+        if (ZSTD_isError(result)) {
+            log_error("zstd: %s", ZSTD_getErrorName(result));
+            ZSTD_freeDStream(stream);
+            return false;
+        }
+        out.insert(out.end(), chunk.begin(), chunk.begin() + output.pos);
+        if (out.size() > MAX_ROM_SIZE) {
+            log_error("zstd stream expands past %u bytes", uint(MAX_ROM_SIZE));
+            ZSTD_freeDStream(stream);
+            return false;
+        }
+        // A full chunk may mean more output is buffered inside zstd
+        full = output.pos == output.size;
+    } while (result != 0 && (input.pos < input.size || full));
+    ZSTD_freeDStream(stream);
+    return result == 0;
+#else
+    unused(in, out);
+    log_error("Built without zstd support (define GB_HAVE_ZSTD and link libzstd)");
+    return false;
+#endif
+}
+
+// Corrupt downloads show up here; the boot ROM only checks the header sum
+void verify_checksums(const std::vector<u8>& rom) {
+    if (compute_header_checksum(rom) != rom[header::header_checksum]) {
+        log_warn("ROM header checksum mismatch");
+    }
+    const u16 global = (rom[header::global_checksum] << 8) | rom[header::global_checksum + 1];
+    if (compute_global_checksum(rom) != global) {
+        log_warn("ROM global checksum mismatch");
+    }
+}
+
+// What a cache entry must pass to be used, and a fresh image to be stored:
+// a good header checksum and, for the standard size codes, the size the
+// header declares. Anything else is decompressed again.
+bool cacheable(const std::vector<u8>& rom) {
+    if (rom.size() < MIN_ROM_SIZE || rom.size() > MAX_ROM_SIZE) return false;
+    if (compute_header_checksum(rom) != rom[header::header_checksum]) return false;
+    const u8 size_code = rom[header::rom_size];
+    return size_code > 0x08 || rom.size() == size_t(0x8000) << size_code;
+}
+
+std::string cache_path(const std::string& cache_dir, const std::vector<u8>& compressed) {
+    char key[40];
+    std::snprintf(key, sizeof(key), "%016llx-%llx.gb",
+                  (unsigned long long)fnv1a64(compressed.data(), compressed.size()),
+                  (unsigned long long)compressed.size());
+    return cache_dir + "/" + key;
+}
+
+std::vector<u8> to_bytes(const std::vector<char>& chars) {
+    return std::vector<u8>(chars.begin(), chars.end());
+}
+
+}
+
+RomFormat detect_rom_format(const std::vector<u8>& data) {
+    if (data.size() >= 2 && data[0] == 0x1F && data[1] == 0x8B) return RomFormat::Gzip;
+    if (data.size() >= 4 && get_u32(data.data()) == 0x04034b50) return RomFormat::Zip;
+    if (data.size() >= 4 && get_u32(data.data()) == 0xFD2FB528) return RomFormat::Zstd;
+    return RomFormat::Raw;
+}
+
+std::string describe(RomFormat format) {
+    switch (format) {
+        case RomFormat::Raw:  return "raw";
+        case RomFormat::Gzip: return "gzip";
+        case RomFormat::Zip:  return "zip";
+        case RomFormat::Zstd: return "zstd";
+    }
+    return "unknown";
+}
+
+bool decompress_rom(const std::vector<u8>& file, std::vector<u8>& rom) {
+    switch (detect_rom_format(file)) {
+        case RomFormat::Raw:  rom = file; return true;
+        case RomFormat::Gzip: return decompress_gzip(file, rom);
+        case RomFormat::Zip:  return decompress_zip(file, rom);
+        case RomFormat::Zstd: return decompress_zstd(file, rom);
+    }
+    return false;
+}
+
+std::vector<u8> load_rom(const std::string& filename, const std::string& cache_dir) {
+    std::vector<u8> file = to_bytes(read_bytes(filename));
+    const RomFormat format = detect_rom_format(file);
+
+    if (format == RomFormat::Raw) {
+        if (file.size() < MIN_ROM_SIZE) fatal_error("%s is too small to be a ROM", filename.c_str());
+        verify_checksums(file);
+        return file;
+    }
+
+    const std::string cached = cache_dir.empty() ? "" : cache_path(cache_dir, file);
+    if (!cached.empty() && file_exists(cached)) {
+        std::vector<u8> rom = to_bytes(read_bytes(cached));
+        if (cacheable(rom)) {
+            log_info("Loaded %s from cache %s", filename.c_str(), cached.c_str());
+            verify_checksums(rom);
+            return rom;
+        }
+        log_warn("Ignoring bad cache entry %s", cached.c_str());
+    }
+
+    std::vector<u8> rom;
+    if (!decompress_rom(file, rom)) fatal_error("Cannot decompress %s (%s)", filename.c_str(), describe(format).c_str());
+    if (rom.size() < MIN_ROM_SIZE) fatal_error("%s is too small to be a ROM", filename.c_str());
+
+    log_info("Decompressed %s: %u -> %u bytes", describe(format).c_str(), uint(file.size()), uint(rom.size()));
+    verify_checksums(rom);
+
+    if (!cached.empty() && cacheable(rom) && make_directory(cache_dir)) {
+        write_file_atomic(cached, rom);
+    }
+    return rom;
+}
+
+std::string strip_compression_extension(const std::string& filename) {
+    for (const char* ext : { ".gz", ".zip", ".zst" }) {
+        const std::string e(ext);
+        if (ends_with(filename, e)) return filename.substr(0, filename.size() - e.size());
+    }
+    return filename;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+
+enum class RomFormat {
+    Raw,
+    Gzip,
+    Zip,
+    Zstd,
+};
+
+// Detected from the magic bytes, not the file name
+RomFormat detect_rom_format(const std::vector<u8>& data);
+std::string describe(RomFormat format);
+
+// Decompresses (or copies, for raw files) without exiting on errors
+bool decompress_rom(const std::vector<u8>& file, std::vector<u8>& rom);
+
+/*
+    Reads a ROM that may be gzip, zip or zstd compressed. Decompressed
+    images are kept in `cache_dir` (if not empty) under a hash of the
+    compressed file, so later launches skip decompression; entries are
+    only used while their header checksum and declared size still match.
+    The archive is read whole before decompressing, as ROMs are at most
+    8MB. Exits on a corrupt archive, like read_bytes does on a missing
+    file.
+*/
+std::vector<u8> load_rom(const std::string& filename, const std::string& cache_dir);
+
+// rom.gb.gz => rom.gb, so saves and the like don't depend on the compression
+std::string strip_compression_extension(const std::string& filename);
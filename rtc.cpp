@@ -0,0 +1,192 @@
+#include "rtc.h"
+#include "log.h"
+
+#include <chrono>
+
+const size_t RealTimeClock::SAVE_SIZE;
+const size_t RealTimeClock::SAVE_SIZE_SHORT;
+
+static const uint64_t NS_PER_SECOND = 1000000000ull;
+static const uint DAY_COUNTER_LIMIT = 512;
+
+namespace rtc_register {
+	const u8 seconds	= 0x08;
+	const u8 minutes	= 0x09;
+	const u8 hours		= 0x0A;
+	const u8 days_low	= 0x0B;
+	const u8 days_high	= 0x0C;
+}
+
+static uint64_t host_unix_seconds() {
+	using namespace std::chrono;
+	return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+}
+
+RealTimeClock::RealTimeClock()
+	: now(host_time_ns) {
+	base_time = now();
+}
+
+uint64_t RealTimeClock::host_time_ns() {
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+void RealTimeClock::set_time_source(time_source_t source) {
+	rebase();
+	now = std::move(source);
+	base_time = now();
+}
+
+uint64_t RealTimeClock::elapsed_ns() const {
+	// A host clock stepping backwards just pauses the RTC
+	const uint64_t t = now();
+	return t > base_time ? t - base_time : 0;
+}
+
+RealTimeClock::Registers RealTimeClock::current() const {
+	Registers r = base;
+	if (!r.halt) advance(r, elapsed_ns() / NS_PER_SECOND);
+	return r;
+}
+
+void RealTimeClock::rebase() {
+	if (base.halt) {
+		base_time = now();
+		return;
+	}
+	const uint64_t seconds = elapsed_ns() / NS_PER_SECOND;
+	advance(base, seconds);
+	base_time += seconds * NS_PER_SECOND;
+}
+
+/*
+	Counters only carry out of a field when it rolls over from its
+	last valid value, so a game-written out-of-range value (e.g. 62
+	seconds) first counts up to the field's bit width and wraps to 0
+	without carrying, as on hardware.
+*/
+void RealTimeClock::advance(Registers& r, uint64_t seconds) {
+	if (seconds == 0) return;
+
+	if (r.seconds >= 60 || r.minutes >= 60 || r.hours >= 24) {
+		// Rare: step one second at a time until the fields are valid again
+		while (seconds && (r.seconds >= 60 || r.minutes >= 60 || r.hours >= 24)) {
+			seconds--;
+			if (r.seconds == 59) {
+				r.seconds = 0;
+				if (r.minutes == 59) {
+					r.minutes = 0;
+					if (r.hours == 23) {
+						r.hours = 0;
+						if (++r.days == DAY_COUNTER_LIMIT) { r.days = 0; r.carry = true; }
+					}
+					else r.hours = (r.hours + 1) & 0x1F;
+				}
+				else r.minutes = (r.minutes + 1) & 0x3F;
+			}
+			else r.seconds = (r.seconds + 1) & 0x3F;
+		}
+		if (!seconds) return;
+	}
+
+	uint64_t total = r.seconds + seconds;
+	r.seconds = total % 60;
+	total = r.minutes + total / 60;
+	r.minutes = total % 60;
+	total = r.hours + total / 60;
+	r.hours = total % 24;
+	total = r.days + total / 24;
+	if (total >= DAY_COUNTER_LIMIT) r.carry = true;
+	r.days = total % DAY_COUNTER_LIMIT;
+}
+
+u8 RealTimeClock::get(const Registers& r, u8 reg) {
+	switch (reg) {
+		case rtc_register::seconds:   return r.seconds;
+		case rtc_register::minutes:   return r.minutes;
+		case rtc_register::hours:     return r.hours;
+		case rtc_register::days_low:  return r.days & 0xFF;
+		case rtc_register::days_high:
+			return ((r.days >> 8) & 0x01) | (r.halt ? 0x40 : 0) | (r.carry ? 0x80 : 0);
+	}
+	return 0xFF;
+}
+
+void RealTimeClock::set(Registers& r, u8 reg, u8 value) {
+	switch (reg) {
+		case rtc_register::seconds:   r.seconds = value & 0x3F; break;
+		case rtc_register::minutes:   r.minutes = value & 0x3F; break;
+		case rtc_register::hours:     r.hours = value & 0x1F; break;
+		case rtc_register::days_low:  r.days = (r.days & 0x100) | value; break;
+		case rtc_register::days_high:
+			r.days = (r.days & 0xFF) | ((value & 0x01) << 8);
+			r.halt = (value & 0x40) != 0;
+			r.carry = (value & 0x80) != 0;
+			break;
+	}
+}
+
+u8 RealTimeClock::read(u8 reg) const {
+	return get(latched, reg);
+}
+
+void RealTimeClock::write(u8 reg, u8 value) {
+	const bool was_halted = base.halt;
+	rebase();
+	set(base, reg, value);
+
+	// Writing the seconds resets the sub-second divider; so does resuming
+	if (reg == rtc_register::seconds || (was_halted && !base.halt)) {
+		base_time = now();
+	}
+	// Writes are visible straight away on the next read
+	set(latched, reg, value);
+}
+
+void RealTimeClock::latch() {
+	latched = current();
+}
+
+static void put_u32(std::vector<u8>& out, uint64_t value) {
+	for (int i = 0; i < 4; i++) out.push_back((value >> (8 * i)) & 0xFF);
+}
+
+static uint64_t get_le(const u8* data, int bytes) {
+	uint64_t value = 0;
+	for (int i = 0; i < bytes; i++) value |= uint64_t(data[i]) << (8 * i);
+	return value;
+}
+
+void RealTimeClock::save(std::vector<u8>& out) const {
+	const Registers r = current();
+	for (u8 reg = rtc_register::seconds; reg <= rtc_register::days_high; reg++) put_u32(out, get(r, reg));
+	for (u8 reg = rtc_register::seconds; reg <= rtc_register::days_high; reg++) put_u32(out, get(latched, reg));
+
+	const uint64_t timestamp = host_unix_seconds();
+	put_u32(out, timestamp & 0xFFFFFFFF);
+	put_u32(out, timestamp >> 32);
+}
+
+bool RealTimeClock::load(const u8* data, size_t size) {
+	if (size != SAVE_SIZE && size != SAVE_SIZE_SHORT) {
+		log_warn("Ignoring RTC data of unexpected size %u", uint(size));
+		return false;
+	}
+
+	Registers r, l;
+	for (u8 i = 0; i < 5; i++) {
+		set(r, rtc_register::seconds + i, get_le(data + 4 * i, 4) & 0xFF);
+		set(l, rtc_register::seconds + i, get_le(data + 20 + 4 * i, 4) & 0xFF);
+	}
+	const uint64_t timestamp = get_le(data + 40, size == SAVE_SIZE ? 8 : 4);
+
+	// Catch up on the time the game was not running
+	const uint64_t t = host_unix_seconds();
+	if (!r.halt && t > timestamp) advance(r, t - timestamp);
+
+	base = r;
+	latched = l;
+	base_time = now();
+	return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "definitions.h"
+
+/*
+	MBC3 real-time clock.
+
+	Nothing ticks: the clock keeps the register values as of a base
+	time and works out the current ones from the elapsed time when the
+	game latches or writes them. The time source is the host clock by
+	default, or emulated time so fast-forwarding also speeds up the
+	clock.
+*/
+class RealTimeClock {
+public:
+	// Monotonic-enough time in nanoseconds
+	using time_source_t = std::function<uint64_t()>;
+
+	// Bytes appended after save RAM: current and latched registers as
+	// 5 little-endian u32 each, then a 64-bit UNIX timestamp
+	static const size_t SAVE_SIZE = 48;
+	// Older files carry a 32-bit timestamp instead
+	static const size_t SAVE_SIZE_SHORT = 44;
+
+	RealTimeClock();
+
+	static uint64_t host_time_ns();
+	void set_time_source(time_source_t source);
+
+	// Register numbers are the 0x08..0x0C RAM bank select values
+	u8 read(u8 reg) const;
+	void write(u8 reg, u8 value);
+	void latch();
+
+	void save(std::vector<u8>& out) const;
+	// Restores the registers and catches up on the time the file was closed
+	bool load(const u8* data, size_t size);
+
+private:
+	struct Registers {
+		uint seconds = 0;
+		uint minutes = 0;
+		uint hours = 0;
+		uint days = 0;		// 9 bits
+		bool halt = false;
+		bool carry = false;
+	};
+
+	Registers current() const;
+	uint64_t elapsed_ns() const;
+
+	// Folds the elapsed whole seconds into base, keeping the sub-second part
+	void rebase();
+
+	static void advance(Registers& r, uint64_t seconds);
+	static u8 get(const Registers& r, u8 reg);
+	static void set(Registers& r, u8 reg, u8 value);
+
+	Registers base;
+	Registers latched;
+	uint64_t base_time = 0;
+	time_source_t now;
+};
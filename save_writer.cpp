@@ -0,0 +1,42 @@
+#include "save_writer.h"
+#include "files.h"
+#include "log.h"
+
+SaveWriter::SaveWriter(std::string inPath)
+    : save_path(std::move(inPath))
+    , worker(&SaveWriter::run, this) {
+}
+
+SaveWriter::~SaveWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void SaveWriter::submit(std::vector<u8> data) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = std::move(data);
+        has_pending = true;
+    }
+    wake.notify_one();
+}
+
+void SaveWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return has_pending || stopping; });
+        if (!has_pending) return;
+
+        std::vector<u8> data = std::move(pending);
+        has_pending = false;
+
+        lock.unlock();
+        if (write_file_atomic(save_path, data))
+            log_debug("Saved %u bytes to %s", uint(data.size()), save_path.c_str());
+        lock.lock();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "definitions.h"
+
+/*
+    Writes battery saves on a background thread so the emulation
+    thread never waits on the disk. Only the newest snapshot matters:
+    one submitted while an earlier one is still queued replaces it.
+*/
+class SaveWriter {
+public:
+    explicit SaveWriter(std::string inPath);
+
+    // Writes out anything still queued before returning
+    ~SaveWriter();
+
+    void submit(std::vector<u8> data);
+
+    const std::string& path() const { return save_path; }
+
+private:
+    void run();
+
+    std::string save_path;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<u8> pending;
+    bool has_pending = false;
+    bool stopping = false;
+
+    std::thread worker;
+};
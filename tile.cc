@@ -2,11 +2,10 @@
 #include "tile.h"
 #include "color.h"
 #include "bitwise.h"
-#include "mmu.h"
 
 using bitwise::bit_value;
 
-Tile::Tile(Address tile_address, MMU& mmu, uint size_multiplier)
+Tile::Tile(Address tile_address, const u8* vram, uint size_multiplier)
     : size(size_multiplier) {
     // Allocate enough for (8size) lines  8 columns
     buffer.resize(TILE_WIDTH_PX * (TILE_HEIGHT_PX * size_multiplier), GBColor::Color0);
@@ -18,8 +17,8 @@ Tile::Tile(Address tile_address, MMU& mmu, uint size_multiplier)
 
         Address line_start = tile_address + index_into_tile;
 
-        u8 pixels_1 = mmu.read(line_start);
-        u8 pixels_2 = mmu.read(line_start + 1);
+        u8 pixels_1 = vram[line_start.value() - 0x8000];
+        u8 pixels_2 = vram[line_start.value() + 1 - 0x8000];
 
         auto pixel_line = get_pixel_line(pixels_1, pixels_2);
 
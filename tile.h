@@ -2,7 +2,6 @@
 
 #include "address.h"
 #include "definitions.h"
-class MMU;
 
 #include <array>
 #include <vector>
@@ -13,7 +12,8 @@ static const uint TILE_BYTES = 16;
 
 class Tile {
 public:
-    Tile(Address tile_address, MMU& mmu, uint size_multiplier = 1);
+    // `vram` holds 0x8000..0x9FFF
+    Tile(Address tile_address, const u8* vram, uint size_multiplier = 1);
 
     auto get_pixel(uint x, uint y) const->GBColor;
 
@@ -1,39 +1,56 @@
 #include "timer.h"
+#include "cpu.h"
+#include "gameboy.h"
 
-void Timer::tick(uint32_t cycles) {
-    div_counter += cycles;
+uint32_t Timer::div_clock(uint64_t now) const {
+    return uint32_t(now - div_base) & 0xFFFF;
+}
 
-    while (div_counter >= 256) {
-        div_counter -= 256;
-        div++;
-    }
+bool Timer::timer_signal(uint64_t now) const {
+    return timer_enabled() && (div_clock(now) & (timer_frequency_cycles() / 2)) != 0;
+}
 
-    if (!timer_enabled()) {
-        return;
+// Every frequency divides the 16-bit counter's period, so the falling
+// edges in (tima_time, now] can be counted without tracking the wrap
+void Timer::sync(uint64_t now) {
+    if (timer_enabled()) {
+        const uint32_t shift = timer_frequency_shift();
+        increment_tima(((now - div_base) >> shift) - ((tima_time - div_base) >> shift));
     }
+    tima_time = now;
+    schedule();
+}
 
-    timer_counter += cycles;
-
-    uint32_t threshold = timer_frequency_cycles();
-
-    while (timer_counter >= threshold) {
-        timer_counter -= threshold;
-
-        if (tima == 0xFF) {
-            tima = tma;
-            interrupt_requested = true;
-        }
-        else {
-            tima++;
+// Reloading from TMA and the interrupt happen at the overflow itself
+void Timer::increment_tima(uint64_t ticks) {
+    while (ticks) {
+        const uint64_t to_overflow = 0x100u - tima;
+        if (ticks < to_overflow) {
+            tima = u8(tima + ticks);
+            return;
         }
+        ticks -= to_overflow;
+        tima = tma;
+        cpu.request_interrupt(interrupt_bits::timer);
     }
 }
 
+void Timer::schedule() {
+    if (!timer_enabled()) {
+        overflow_at = ~0ull;
+        return;
+    }
+    const uint32_t period = timer_frequency_cycles();
+    const uint64_t next_edge = tima_time + period - (div_clock(tima_time) & (period - 1));
+    overflow_at = next_edge + uint64_t(0xFFu - tima) * period;
+}
+
 u8 Timer::read_div() const {
-    return div;
+    return u8(div_clock(gb.now()) >> 8);
 }
 
-u8 Timer::read_tima() const {
+u8 Timer::read_tima() {
+    sync(gb.now());
     return tima;
 }
 
@@ -45,41 +62,71 @@ u8 Timer::read_tac() const {
     return tac | 0xF8;
 }
 
+// Resetting the counter is a falling edge if TIMA's bit was set
 void Timer::write_div(u8 value) {
     unused(value);
-    div = 0;
-    div_counter = 0;
+    const uint64_t now = gb.now();
+    sync(now);
+    if (timer_signal(now)) increment_tima(1);
+    div_base = now;
+    schedule();
 }
 
 void Timer::write_tima(u8 value) {
+    sync(gb.now());
     tima = value;
+    schedule();
 }
 
 void Timer::write_tma(u8 value) {
+    sync(gb.now());
     tma = value;
 }
 
+// As with DIV, the signal dropping (disabled, or switched to a bit that
+// is clear) counts as an edge
 void Timer::write_tac(u8 value) {
+    const uint64_t now = gb.now();
+    sync(now);
+    const bool was_high = timer_signal(now);
     tac = (value & 0x07) | 0xF8;
+    if (was_high && !timer_signal(now)) increment_tima(1);
+    schedule();
 }
 
-bool Timer::consume_interrupt_request() {
-    bool requested = interrupt_requested;
-    interrupt_requested = false;
-    return requested;
+uint32_t Timer::cycles_until_change(bool div_read, bool tima_read) const {
+    const uint64_t now = gb.now();
+    uint32_t cycles = ~0u;
+
+    if (div_read) {
+        cycles = 256 - (div_clock(now) & 0xFF);
+    }
+
+    if (timer_enabled()) {
+        uint32_t threshold = timer_frequency_cycles();
+        uint32_t next_tick = threshold - (div_clock(now) & (threshold - 1));
+        uint64_t until = tima_read ? next_tick : (overflow_at > now ? overflow_at - now : 0);
+        if (until < cycles) cycles = uint32_t(until);
+    }
+
+    return cycles;
 }
 
 bool Timer::timer_enabled() const {
     return (tac & 0x04) != 0;
 }
 
-uint32_t Timer::timer_frequency_cycles() const {
+uint32_t Timer::timer_frequency_shift() const {
     switch (tac & 0x03) {
-    case 0x00: return 1024; // 4096 Hz
-    case 0x01: return 16;   // 262144 Hz
-    case 0x02: return 64;   // 65536 Hz
-    case 0x03: return 256;  // 16384 Hz
+    case 0x00: return 10;   // 4096 Hz
+    case 0x01: return 4;    // 262144 Hz
+    case 0x02: return 6;    // 65536 Hz
+    case 0x03: return 8;    // 16384 Hz
     }
 
-    return 1024;
-}
\ No newline at end of file
+    return 10;
+}
+
+uint32_t Timer::timer_frequency_cycles() const {
+    return 1u << timer_frequency_shift();
+}
@@ -2,12 +2,26 @@
 
 #include "definitions.h"
 
+class CPU;
+class Gameboy;
+
+/*
+    DIV is the upper byte of a 16-bit counter that runs at the clock,
+    and TIMA counts falling edges of one of its bits (chosen by TAC).
+    Neither is stepped: both are derived from the Gameboy's clock when
+    the registers are accessed, and the only thing checked per
+    instruction is whether the clock has passed the next TIMA overflow.
+*/
 class Timer {
 public:
-    void tick(uint32_t cycles);
+    Timer(CPU& inCPU, const Gameboy& inGb) : cpu(inCPU), gb(inGb) {}
+
+    // Call with the clock after each step; requests the interrupt for
+    // any overflow that is due
+    void tick(uint64_t now) { if (now >= overflow_at) sync(now); }
 
     u8 read_div() const;
-    u8 read_tima() const;
+    u8 read_tima();
     u8 read_tma() const;
     u8 read_tac() const;
 
@@ -16,19 +30,34 @@ public:
     void write_tma(u8 value);
     void write_tac(u8 value);
 
-    bool consume_interrupt_request();
+    // Cycles until the next interrupt request, or until the next change of
+    // DIV / TIMA when asked for; ~0u if nothing is due
+    uint32_t cycles_until_change(bool div_read, bool tima_read) const;
 
 private:
-    uint32_t div_counter = 0;
-    uint32_t timer_counter = 0;
+    CPU& cpu;
+    const Gameboy& gb;
+
+    // The counter started at div_base; post-boot DIV reads 0xAB
+    uint64_t div_base = 0 - uint64_t(0xAB << 8);
 
-    u8 div = 0xAB;   // post-boot
+    // TIMA as of tima_time, and the clock at which it next overflows
     u8 tima = 0x00;
+    uint64_t tima_time = 0;
+    uint64_t overflow_at = ~0ull;
+
     u8 tma = 0x00;
     u8 tac = 0xF8;
 
-    bool interrupt_requested = false;
-
+    uint32_t div_clock(uint64_t now) const;
     bool timer_enabled() const;
+    uint32_t timer_frequency_shift() const;
     uint32_t timer_frequency_cycles() const;
-};
\ No newline at end of file
+    // The counter bit TIMA is clocked from, ANDed with the enable bit
+    bool timer_signal(uint64_t now) const;
+
+    // Brings TIMA up to `now`, then reschedules the overflow
+    void sync(uint64_t now);
+    void increment_tima(uint64_t ticks);
+    void schedule();
+};
@@ -7,11 +7,19 @@
 #include "log.h"
 #include "gameboy.h"
 
+#include <algorithm>
+
 using bitwise::check_bit;
 
-Video::Video(Gameboy& inGb)
+Video::Video(Gameboy& inGb, bool inHeadless)
     : gb(inGb)
-    , buffer(GAMEBOY_WIDTH, GAMEBOY_HEIGHT) {
+    , buffer(inHeadless ? 0 : GAMEBOY_WIDTH, inHeadless ? 0 : GAMEBOY_HEIGHT)
+    , render_frame(!inHeadless)
+    , headless(inHeadless)
+    , logging(!inHeadless)
+    , frame_vram(VRAM_SIZE, 0) {
+    // Memory starts out zeroed, so the empty copy matches it for the first frame
+
     // Initialize registers to 0 if needed
     lcd_control.set(0x91);
     lcd_status.set(0x85);
@@ -27,103 +35,432 @@ Video::Video(Gameboy& inGb)
     window_x.set(0x00);
 }
 
-// Called after each CPU instruction. 'cycles' = how many cycles that instruction used.
-void Video::tick(Cycles cycles) {
-    cycle_counter += cycles.cycles;
+// Clock cycles since the current mode began
+uint Video::mode_cycles() const {
+    return uint(gb.now() - mode_start);
+}
+
+// Called after each CPU instruction or block, once the clock covers it.
+// A block or a skipped idle loop can span several modes, so this catches
+// up on all of them.
+template <PpuTiming Timing>
+void Video::tick() {
+    while (advance_mode<Timing>()) {}
+}
+
+// Moves to the next mode if the current one has run its length
+template <PpuTiming Timing>
+bool Video::advance_mode() {
+    const bool fifo = Timing == PpuTiming::PixelFifo;
+    const uint vram_length = fifo ? mode3_length : CLOCKS_PER_SCANLINE_VRAM;
+    const uint hblank_length = fifo ? CLOCKS_PER_SCANLINE - CLOCKS_PER_SCANLINE_OAM - mode3_length : CLOCKS_PER_HBLANK;
+
+    const uint elapsed = mode_cycles();
 
     switch (current_mode) {
         case VideoMode::ACCESS_OAM:
-        if (cycle_counter >= CLOCKS_PER_SCANLINE_OAM) {
-            cycle_counter -= CLOCKS_PER_SCANLINE_OAM;
+        if (elapsed >= CLOCKS_PER_SCANLINE_OAM) {
+            mode_start += CLOCKS_PER_SCANLINE_OAM;
+            // Mode 3's length depends on the sprites even when not drawing
+            if (render_frame || fifo) evaluate_sprites(line.value());
+            if (fifo) {
+                schedule_mode3();
+                if (render_frame) log_line();
+            }
             current_mode = VideoMode::ACCESS_VRAM;
             // Mode 3
             lcd_status.set((lcd_status.value() & 0xFC) | 0x03);
+            update_stat();
+            return true;
         }
         break;
 
         case VideoMode::ACCESS_VRAM:
-        if (cycle_counter >= CLOCKS_PER_SCANLINE_VRAM) {
-            cycle_counter -= CLOCKS_PER_SCANLINE_VRAM;
+        if (elapsed >= vram_length) {
+            mode_start += vram_length;
+            // PixelFifo lines can take register writes until here
+            if (fifo && threaded && render_frame) publish_lines(lines_logged);
             current_mode = VideoMode::HBLANK;
             // Mode 0
             lcd_status.set((lcd_status.value() & 0xFC) | 0x00);
+            update_stat();
+            return true;
         }
         break;
 
         case VideoMode::HBLANK: {
-            if (cycle_counter >= CLOCKS_PER_HBLANK) {
-                cycle_counter -= CLOCKS_PER_HBLANK;
-                write_scanline(line.value());
+            if (elapsed >= hblank_length) {
+                mode_start += hblank_length;
+                if (!fifo && render_frame) {
+                    log_line();
+                    if (threaded) publish_lines(lines_logged);
+                }
                 line.increment();
 
                 if (line.value() == 144) {
+                    if (render_frame && !threaded) render_logged_frame();
+                    logging = false;
                     current_mode = VideoMode::VBLANK;
                     // Mode 1
                     lcd_status.set((lcd_status.value() & 0xFC) | 0x01);
-                    gb.cpu.interrupt_flag.set_bit_to(0, true);
+                    update_stat();
+                    gb.cpu.request_interrupt(interrupt_bits::vblank);
                 }
                 else {
                     current_mode = VideoMode::ACCESS_OAM;
                     // Mode 2
                     lcd_status.set((lcd_status.value() & 0xFC) | 0x02);
+                    update_stat();
                 }
+                return true;
             }
             break;
         }
         case VideoMode::VBLANK:
         if (line.value() >= 144 && line.value() < 154) {
-            if (cycle_counter >= CLOCKS_PER_SCANLINE) {
-                cycle_counter -= CLOCKS_PER_SCANLINE;
+            if (elapsed >= CLOCKS_PER_SCANLINE) {
+                mode_start += CLOCKS_PER_SCANLINE;
                 line.increment();
+                if (line.value() <= 153) update_stat();
 
                 if (line.value() > 153) {
                     line.set(0);
                     current_mode = VideoMode::ACCESS_OAM;
                     // Mode 2
                     lcd_status.set((lcd_status.value() & 0xFC) | 0x02);
-                    write_sprites();
+                    update_stat();
+                    finish_rendering();
                     draw();
-                    buffer.reset();
+                    next_frame();
                 }
+                return true;
             }
         }
         break;
     }
+    return false;
+}
+
+template void Video::tick<PpuTiming::Fixed>();
+template void Video::tick<PpuTiming::PixelFifo>();
+
+// Only called where the mode or LY changes, or STAT/LYC are written,
+// which are the only points the line can change
+void Video::update_stat() {
+    const u8 stat = lcd_status.value();
+    const bool coincidence = line.value() == ly_compare.value();
+    lcd_status.set(coincidence ? (stat | 0x04) : (stat & ~0x04));
+
+    const uint mode = stat & 0x03;
+    const bool high = (coincidence && check_bit(stat, 6))
+        || (mode == 0 && check_bit(stat, 3))
+        || (mode == 1 && check_bit(stat, 4))
+        || (mode == 2 && check_bit(stat, 5));
+
+    if (high && !stat_line) gb.cpu.request_interrupt(interrupt_bits::lcdc_status);
+    stat_line = high;
+}
+
+// Bits 0-2 (mode and coincidence) are read-only
+void Video::write_stat(u8 value) {
+    lcd_status.set((value & 0x78) | (lcd_status.value() & 0x07));
+    update_stat();
+}
+
+void Video::write_ly_compare(u8 value) {
+    ly_compare.set(value);
+    update_stat();
+}
+
+void Video::reset_line() {
+    line.set(0);
+    update_stat();
+}
+
+uint Video::cycles_until_event() const {
+    uint length = CLOCKS_PER_SCANLINE;
+    switch (current_mode) {
+        case VideoMode::ACCESS_OAM:  length = CLOCKS_PER_SCANLINE_OAM; break;
+        case VideoMode::ACCESS_VRAM: length = mode3_length; break;
+        case VideoMode::HBLANK:      length = CLOCKS_PER_SCANLINE - CLOCKS_PER_SCANLINE_OAM - mode3_length; break;
+        case VideoMode::VBLANK:      length = CLOCKS_PER_SCANLINE; break;
+    }
+    const uint elapsed = mode_cycles();
+    return elapsed < length ? length - elapsed : 0;
+}
+
+// These describe the line being drawn, not the live register
+bool Video::display_enabled() const { return check_bit(line_state.lcdc, 7); }
+bool Video::window_tile_map() const { return check_bit(line_state.lcdc, 6); }
+bool Video::window_enabled() const { return check_bit(line_state.lcdc, 5); }
+bool Video::bg_window_tile_data() const { return check_bit(line_state.lcdc, 4); }
+bool Video::bg_tile_map_display() const { return check_bit(line_state.lcdc, 3); }
+bool Video::sprite_size() const { return check_bit(line_state.lcdc, 2); }
+bool Video::sprites_enabled() const { return check_bit(line_state.lcdc, 1); }
+bool Video::bg_enabled() const { return check_bit(line_state.lcdc, 0); }
+
+void Video::begin_frame_log() {
+    const u8* vram = gb.mmu.video_memory(0x8000);
+    std::copy(vram, vram + VRAM_SIZE, frame_vram.begin());
+
+    for (auto& writes : vram_writes) writes.clear();
+    lines_logged = 0;
+    logging = true;
+
+    if (threaded) {
+        std::lock_guard<std::mutex> lock(render_mutex);
+        lines_published = 0;
+        lines_rendered = 0;
+    }
+}
+
+void Video::log_line() {
+    // A write to LY can restart the frame; the log only holds one frame
+    if (lines_logged >= GAMEBOY_HEIGHT) return;
+
+    LineState& r = line_log[lines_logged++];
+    r.ly = line.value();
+    r.lcdc = lcd_control.value();
+    r.scy = scroll_y.value();
+    r.scx = scroll_x.value();
+    r.wy = window_y.value();
+    r.wx = window_x.value();
+    r.bgp = bg_palette.value();
+    r.obp0 = sprite_palette_0.value();
+    r.obp1 = sprite_palette_1.value();
+    r.write_count = 0;
+
+    r.sprites = scan_sprites;
+    r.sprite_count = scan_sprite_count;
+}
+
+// Pixel x comes out of the FIFO at fifo_start + x dots, plus the stalls
+// for anything it passed on the way. Only the first sprite in each tile
+// column waits for the BG fetch of that tile to finish (5 dots at most).
+void Video::schedule_mode3() {
+    const u8 lcdc = lcd_control.value();
+    const uint scx = scroll_x.value();
+    const uint wx = window_x.value();
+
+    fifo_start = FIFO_LATENCY + (scx & 7);
+    fifo_stall_count = 0;
+    uint stalled = 0;
+
+    auto add_stall = [&](uint x, uint dots) {
+        uint at = fifo_stall_count++;
+        for (; at > 0 && fifo_stalls[at - 1].x > x; at--) {
+            fifo_stalls[at] = fifo_stalls[at - 1];
+        }
+        fifo_stalls[at] = { x, dots };
+        stalled += dots;
+    };
+
+    const bool window = check_bit(lcdc, 5) && window_y.value() <= line.value() && wx <= 166;
+    const uint window_x0 = window ? (wx >= 7 ? wx - 7 : 0) : GAMEBOY_WIDTH;
+    if (window) add_stall(window_x0, WINDOW_STALL);
+
+    if (check_bit(lcdc, 1)) {
+        std::array<uint, MAX_SPRITES_PER_LINE> columns;
+        uint column_count = 0;
+
+        for (uint i = 0; i < scan_sprite_count; i++) {
+            const LineSprite& sprite = scan_sprites[i];
+            if (sprite.x >= GAMEBOY_WIDTH + 8) continue;
+
+            const uint x = sprite.x >= 8 ? sprite.x - 8 : 0;
+            uint dots = SPRITE_STALL_MAX;
+            if (sprite.x != 0) {
+                const bool in_window = x >= window_x0;
+                const uint offset = in_window ? x - window_x0 : x + scx;
+                const uint column = (offset >> 3) | (in_window ? 0x100 : 0);
+
+                dots = SPRITE_STALL;
+                if (std::find(columns.begin(), columns.begin() + column_count, column) == columns.begin() + column_count) {
+                    columns[column_count++] = column;
+                    dots += (offset & 7) < 5 ? 5 - (offset & 7) : 0;
+                }
+            }
+            add_stall(x, dots);
+        }
+    }
+
+    mode3_length = CLOCKS_PER_SCANLINE_VRAM + (scx & 7) + stalled;
+}
+
+uint Video::pixel_at_dot(uint dot) const {
+    if (dot <= fifo_start) return 0;
+    uint remaining = dot - fifo_start;
+    uint x = 0;
+
+    for (uint i = 0; i < fifo_stall_count; i++) {
+        const FifoStall& stall = fifo_stalls[i];
+        if (remaining <= stall.x - x) return x + remaining;
+        remaining -= stall.x - x;
+        x = stall.x;
+        if (remaining <= stall.dots) return x;
+        remaining -= stall.dots;
+    }
+    return std::min(x + remaining, GAMEBOY_WIDTH);
+}
+
+// The CPU has run up to the end of the writing instruction, video only
+// to its start, so this can land up to one instruction early
+void Video::log_mid_line_write(u16 address, u8 value) {
+    switch (address) {
+        case 0xFF40: case 0xFF42: case 0xFF43: case 0xFF47:
+        case 0xFF48: case 0xFF49: case 0xFF4A: case 0xFF4B:
+            break;
+        default:
+            return;
+    }
+    if (lines_logged == 0) return;
+
+    LineState& state = line_log[lines_logged - 1];
+    if (state.ly != line.value() || state.write_count == MAX_LINE_WRITES) return;
+
+    state.writes[state.write_count++] = { u8(pixel_at_dot(mode_cycles())), u8(address - 0xFF40), value };
+}
+
+// Writes during VBlank aren't logged: the next frame starts from a new copy
+void Video::render_logged_frame() {
+    for (uint n = 0; n < lines_logged; n++) {
+        render_logged_line(n);
+    }
+}
+
+void Video::render_logged_line(uint n) {
+    for (const VramWrite& write : vram_writes[n]) {
+        frame_vram[write.address - 0x8000] = write.value;
+    }
+    line_state = line_log[n];
+    write_scanline(line_state.ly);
+}
+
+void Video::start_render_thread() {
+    if (headless || threaded) return;
+    threaded = true;
+    render_thread = std::thread([this]() { render_thread_main(); });
+}
+
+Video::~Video() {
+    if (!threaded) return;
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+        render_thread_stop = true;
+    }
+    lines_published_cv.notify_one();
+    render_thread.join();
 }
 
-bool Video::display_enabled() const { return check_bit(lcd_control.value(), 7); }
-bool Video::window_tile_map() const { return check_bit(lcd_control.value(), 6); }
-bool Video::window_enabled() const { return check_bit(lcd_control.value(), 5); }
-bool Video::bg_window_tile_data() const { return check_bit(lcd_control.value(), 4); }
-bool Video::bg_tile_map_display() const { return check_bit(lcd_control.value(), 3); }
-bool Video::sprite_size() const { return check_bit(lcd_control.value(), 2); }
-bool Video::sprites_enabled() const { return check_bit(lcd_control.value(), 1); }
-bool Video::bg_enabled() const { return check_bit(lcd_control.value(), 0); }
+void Video::render_thread_main() {
+    std::unique_lock<std::mutex> lock(render_mutex);
+    while (true) {
+        lines_published_cv.wait(lock, [this]() { return render_thread_stop || lines_rendered < lines_published; });
+        if (render_thread_stop) return;
+
+        // A line's log and VRAM writes are complete once it's published
+        const uint n = lines_rendered;
+        lock.unlock();
+        render_logged_line(n);
+        lock.lock();
+
+        lines_rendered = n + 1;
+        if (lines_rendered == lines_published) lines_rendered_cv.notify_one();
+    }
+}
+
+void Video::publish_lines(uint count) {
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+        lines_published = count;
+    }
+    lines_published_cv.notify_one();
+}
+
+void Video::finish_rendering() {
+    if (!threaded) return;
+    std::unique_lock<std::mutex> lock(render_mutex);
+    lines_rendered_cv.wait(lock, [this]() { return lines_rendered == lines_published; });
+}
 
 void Video::write_scanline(u8 current_line) {
     if (!display_enabled()) {
         return;
     }
 
+    bg_line.fill(0);
+    bg_shade.fill(static_cast<u8>(Color::White));
+    sprite_mask.fill(0);
+
+    // Each run of pixels between mid-line writes uses the registers in
+    // effect for it; sprites use the values the line ended with
+    uint x = 0;
+    for (uint i = 0; i < line_state.write_count; i++) {
+        const RegisterWrite& write = line_state.writes[i];
+        draw_background(current_line, x, write.x);
+        x = std::max<uint>(x, write.x);
+
+        switch (write.reg) {
+            case 0x0: line_state.lcdc = write.value; break;
+            case 0x2: line_state.scy = write.value; break;
+            case 0x3: line_state.scx = write.value; break;
+            case 0x7: line_state.bgp = write.value; break;
+            case 0x8: line_state.obp0 = write.value; break;
+            case 0x9: line_state.obp1 = write.value; break;
+            case 0xA: line_state.wy = write.value; break;
+            case 0xB: line_state.wx = write.value; break;
+        }
+    }
+    draw_background(current_line, x, GAMEBOY_WIDTH);
+
+    if (sprites_enabled()) {
+        draw_sprites_line(current_line);
+    }
+    composite_line(current_line);
+}
+
+void Video::draw_background(uint current_line, uint x_begin, uint x_end) {
+    if (x_begin >= x_end) return;
     if (bg_enabled()) {
-        draw_bg_line(current_line);
+        draw_bg_line(current_line, x_begin, x_end);
     }
     if (window_enabled()) {
-        draw_window_line(current_line);
+        draw_window_line(current_line, x_begin, x_end);
     }
 }
 
-// After all lines are drawn, we can draw all sprites
-void Video::write_sprites() {
-    if (!sprites_enabled()) return;
-
-    for (uint spriteIndex = 0; spriteIndex < 40; spriteIndex++) {
-        draw_sprite(spriteIndex);
+// The first 10 sprites in OAM order that cover the line, then sorted by X.
+// Insertion keeps OAM order among equal X, which is the DMG tie-break.
+void Video::evaluate_sprites(uint current_line) {
+    auto& line_sprites = scan_sprites;
+    uint& line_sprite_count = scan_sprite_count;
+
+    const uint height = check_bit(lcd_control.value(), 2) ? 16 : 8;
+    const u8* oam = gb.mmu.video_memory(0xFE00);
+    line_sprite_count = 0;
+
+    for (uint n = 0; n < OAM_SPRITES && line_sprite_count < MAX_SPRITES_PER_LINE; n++) {
+        const uint entry = n * 4;
+        LineSprite sprite;
+        sprite.y = oam[entry];
+        // Y is offset by 16, so the line is covered when y <= line + 16 < y + height
+        if (current_line + 16 < sprite.y || current_line + 16 >= sprite.y + height) continue;
+
+        sprite.x = oam[entry + 1];
+        sprite.tile = oam[entry + 2];
+        sprite.attr = oam[entry + 3];
+        sprite.oam_index = u8(n);
+
+        uint at = line_sprite_count++;
+        for (; at > 0 && line_sprites[at - 1].x > sprite.x; at--) {
+            line_sprites[at] = line_sprites[at - 1];
+        }
+        line_sprites[at] = sprite;
     }
 }
 
 // Renders background for one line
-void Video::draw_bg_line(uint current_line) {
+void Video::draw_bg_line(uint current_line, uint x_begin, uint x_end) {
     // Typical addresses
     const Address TILE_SET_ZERO_ADDRESS = 0x8000;
     const Address TILE_SET_ONE_ADDRESS = 0x8800;
@@ -140,9 +477,9 @@ void Video::draw_bg_line(uint current_line) {
     Address tile_map = use_tile_map_zero ? TILE_MAP_ZERO_ADDRESS : TILE_MAP_ONE_ADDRESS;
 
     // For each pixel in [0..159]
-    for (uint screen_x = 0; screen_x < GAMEBOY_WIDTH; screen_x++) {
-        uint scrolled_x = screen_x + scroll_x.value();
-        uint scrolled_y = current_line + scroll_y.value();
+    for (uint screen_x = x_begin; screen_x < x_end; screen_x++) {
+        uint scrolled_x = screen_x + line_state.scx;
+        uint scrolled_y = current_line + line_state.scy;
 
         // BG is 256256, repeated tile map
         uint tile_map_x = scrolled_x % 256;
@@ -154,7 +491,7 @@ void Video::draw_bg_line(uint current_line) {
         uint tile_index = tile_y * 32 + tile_x;
 
         // read tile ID
-        u8 tile_id = gb.mmu.read(tile_map + tile_index);
+        u8 tile_id = vram_read((tile_map + tile_index).value());
 
         // If using tile_set_one, interpret tile_id as signed
         s16 tile_number = use_tile_set_zero ? tile_id : (s8)tile_id + 128;
@@ -167,14 +504,16 @@ void Video::draw_bg_line(uint current_line) {
         uint pixel_y = tile_map_y % 8;
 
         // read tile
-        Tile tile(tile_address, gb.mmu);
+        Tile tile(tile_address, frame_vram.data());
         GBColor colorIdx = tile.get_pixel(pixel_x, pixel_y);
 
+        bg_line[screen_x] = static_cast<u8>(colorIdx);
+
         // apply the BG palette
-        auto palette = load_palette(bg_palette);
+        auto palette = load_palette(line_state.bgp);
         auto final_color = get_color_from_palette(colorIdx, palette);
 
-        buffer.set_pixel(screen_x, current_line, final_color);
+        bg_shade[screen_x] = static_cast<u8>(final_color);
     }
 }
 
@@ -192,15 +531,15 @@ static Color get_real_color(u8 pixel_value) {
 }
 
 // Renders window (similar logic) for one line
-void Video::draw_window_line(uint current_line) {
-    if (current_line < window_y.value()) {
+void Video::draw_window_line(uint current_line, uint x_begin, uint x_end) {
+    if (current_line < line_state.wy) {
         return; // Window not yet on screen
     }
-    uint win_line = current_line - window_y.value();
+    uint win_line = current_line - line_state.wy;
     if (win_line >= GAMEBOY_HEIGHT) return;
 
     // window_x register is offset by 7
-    int win_x_offset = (int)window_x.value() - 7;
+    int win_x_offset = (int)line_state.wx - 7;
 
     const Address TILE_SET_ZERO_ADDRESS = 0x8000;
     const Address TILE_SET_ONE_ADDRESS  = 0x8800;
@@ -214,7 +553,7 @@ void Video::draw_window_line(uint current_line) {
     bool use_window_tile_map_one = window_tile_map();
     Address tile_map = use_window_tile_map_one ? TILE_MAP_ONE_ADDRESS : TILE_MAP_ZERO_ADDRESS;
 
-    for (uint screen_x = 0; screen_x < GAMEBOY_WIDTH; screen_x++) {
+    for (uint screen_x = x_begin; screen_x < x_end; screen_x++) {
         int win_x = (int)screen_x - win_x_offset;
         if (win_x < 0) continue;
 
@@ -222,7 +561,7 @@ void Video::draw_window_line(uint current_line) {
         uint tile_y = win_line / 8;
         uint tile_index = tile_y * 32 + tile_x;
 
-        u8 tile_id = gb.mmu.read(tile_map + tile_index);
+        u8 tile_id = vram_read((tile_map + tile_index).value());
         s16 tile_number = use_tile_set_zero ? tile_id : (s8)tile_id + 128;
 
         Address tile_address = tile_set + (tile_number * 16);
@@ -230,74 +569,73 @@ void Video::draw_window_line(uint current_line) {
         uint pixel_x = (uint)win_x % 8;
         uint pixel_y = win_line % 8;
 
-        Tile tile(tile_address, gb.mmu);
+        Tile tile(tile_address, frame_vram.data());
         GBColor colorIdx = tile.get_pixel(pixel_x, pixel_y);
+        bg_line[screen_x] = static_cast<u8>(colorIdx);
 
-        auto palette = load_palette(bg_palette);
+        auto palette = load_palette(line_state.bgp);
         auto final_color = get_color_from_palette(colorIdx, palette);
 
-        buffer.set_pixel(screen_x, current_line, final_color);
+        bg_shade[screen_x] = static_cast<u8>(final_color);
     }
 }
 
-void Video::draw_sprite(uint sprite_n) {
-    // OAM is at 0xFE00
-    Address oam_start = Address(0xFE00 + sprite_n * 4);
-
-    u8 posY    = gb.mmu.read(oam_start + 0); // Y pos
-    u8 posX    = gb.mmu.read(oam_start + 1); // X pos
-    u8 tileNum = gb.mmu.read(oam_start + 2);
-    u8 attr    = gb.mmu.read(oam_start + 3);
-
-    // Sprites are offset: posX-8, posY-16
-    int sprite_x = (int)posX - 8;
-    int sprite_y = (int)posY - 16;
+void Video::draw_sprites_line(uint current_line) {
+    const uint height = sprite_size() ? 16 : 8;
 
-    bool tall_sprites = sprite_size(); // bit 2 LCDC: false=8x8, true=8x16
-    uint height = tall_sprites ? 16 : 8;
-    if (tall_sprites) tileNum &= 0xFE; // 8x16: ignore bit 0
+    for (uint i = 0; i < line_state.sprite_count; i++) {
+        const LineSprite& sprite = line_state.sprites[i];
+        // Entirely off the left or right edge
+        if (sprite.x == 0 || sprite.x >= GAMEBOY_WIDTH + 8) continue;
 
-    bool flip_x = (attr & 0x20) != 0;
-    bool flip_y = (attr & 0x40) != 0;
-    bool use_pal1 = (attr & 0x10) != 0;
-    bool bg_priority = (attr & 0x80) != 0;
+        // LCDC may have switched to 8x8 since the OAM scan
+        uint row = current_line + 16 - sprite.y;
+        if (row >= height) continue;
 
-    const ByteRegister& pal_reg = use_pal1 ? sprite_palette_1 : sprite_palette_0;
-    auto palette = load_palette(pal_reg);
+        bool flip_x = (sprite.attr & 0x20) != 0;
+        bool flip_y = (sprite.attr & 0x40) != 0;
+        bool use_pal1 = (sprite.attr & 0x10) != 0;
+        const u8 behind = (sprite.attr & 0x80) ? 0xFF : 0x00;
 
-    Address tile_address = Address(0x8000 + tileNum * 16);
-    Tile tile(tile_address, gb.mmu, tall_sprites ? 2 : 1);
+        if (flip_y) row = height - 1 - row;
+        u8 tile_number = height == 16 ? (sprite.tile & 0xFE) : sprite.tile;
 
-    for (uint ty = 0; ty < height; ty++) {
-        int screen_y = sprite_y + (int)ty;
-        if (screen_y < 0 || screen_y >= (int)GAMEBOY_HEIGHT) continue;
+        const u16 row_address = u16(0x8000 + tile_number * TILE_BYTES + row * 2);
+        const u8 pixels_1 = vram_read(row_address);
+        const u8 pixels_2 = vram_read(row_address + 1);
 
-        uint flipped_y = flip_y ? (height - 1 - ty) : ty;
+        const u8 palette = use_pal1 ? line_state.obp1 : line_state.obp0;
 
+        // Sprites come highest priority first, so a pixel goes to the first
+        // opaque one, even if that one is then hidden behind the BG
         for (uint tx = 0; tx < 8; tx++) {
-            int screen_x = sprite_x + (int)tx;
-            if (screen_x < 0 || screen_x >= (int)GAMEBOY_WIDTH) continue;
-
-            uint flipped_x = flip_x ? (7 - tx) : tx;
-
-            GBColor colorIdx = tile.get_pixel(flipped_x, flipped_y);
-            if (colorIdx == GBColor::Color0) continue; // transparent
-
-            // bg_priority: sprite is behind BG colors 1-3
-            if (bg_priority) {
-                Color existing = buffer.get_pixel(screen_x, screen_y);
-                if (existing != Color::White) continue;
-            }
-
-            auto final_color = get_color_from_palette(colorIdx, palette);
-            buffer.set_pixel(screen_x, screen_y, final_color);
+            const uint at = sprite.x + tx;  // screen x + 8
+            const uint bit = flip_x ? tx : 7 - tx;
+            const u8 color_index = (u8)((((pixels_2 >> bit) & 1) << 1) | ((pixels_1 >> bit) & 1));
+
+            const u8 take = u8(-u8(color_index != 0)) & u8(~sprite_mask[at]);
+            sprite_mask[at] |= take;
+            sprite_shade[at] = u8((sprite_shade[at] & ~take) | (((palette >> (2 * color_index)) & 0x03) & take));
+            sprite_behind[at] = u8((sprite_behind[at] & ~take) | (behind & take));
         }
     }
 }
 
-Palette Video::load_palette(const ByteRegister& palette_reg) {
+// Sprite over BG unless the winning sprite is behind BG colours 1-3. All
+// masks, so the loop has no branches and vectorizes.
+void Video::composite_line(uint current_line) {
+    std::array<u8, GAMEBOY_WIDTH> shades;
+    for (uint x = 0; x < GAMEBOY_WIDTH; x++) {
+        const u8 bg_opaque = u8(-u8(bg_line[x] != 0));
+        const u8 show = sprite_mask[x + 8] & u8(~(sprite_behind[x + 8] & bg_opaque));
+        shades[x] = u8((sprite_shade[x + 8] & show) | (bg_shade[x] & ~show));
+    }
+    buffer.set_line(current_line, shades.data());
+}
+
+Palette Video::load_palette(u8 palette_reg) {
     using bitwise::compose_bits;
-    auto p = palette_reg.value();
+    auto p = palette_reg;
 
     // Each pair of bits is a color
     // bits 0-1 => color0, bits 2-3 => color1, bits 4-5 => color2, bits 6-7 => color3
@@ -327,9 +665,24 @@ void Video::register_vblank_callback(const vblank_callback_t& cb) {
     vblank_callback = cb;
 }
 
+void Video::set_frame_skip(uint frames) {
+    frame_skip = frames;
+}
+
+// Skipped frames keep the last rendered picture in the buffer
+void Video::next_frame() {
+    if (headless) return;
+    frames_until_render = render_frame ? frame_skip : frames_until_render - 1;
+    render_frame = frames_until_render == 0;
+    if (render_frame) {
+        buffer.reset();
+        begin_frame_log();
+    }
+}
+
 // Called at end of VBlank (or start?), to deliver the final buffer
 void Video::draw() {
     if (vblank_callback) {
-        vblank_callback(buffer);
+        vblank_callback(buffer, render_frame);
     }
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <array>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "definitions.h"
@@ -11,7 +15,9 @@
 
 class Gameboy; // for now
 
-using vblank_callback_t = std::function<void(const FrameBuffer&)>;
+// `rendered` is false for frames skipped by set_frame_skip, whose buffer
+// still holds the last rendered frame
+using vblank_callback_t = std::function<void(const FrameBuffer&, bool rendered)>;
 
 enum class VideoMode {
     ACCESS_OAM,
@@ -20,6 +26,19 @@ enum class VideoMode {
     VBLANK,
 };
 
+/*
+    Fixed: mode 3 always takes 172 dots and each line is drawn with the
+    registers as they are at its end.
+    PixelFifo: mode 3 takes as long as the fetcher and pixel FIFO would
+    (fine scroll, window start, sprite fetches), lines start from the
+    registers at the beginning of mode 3, and register writes during
+    mode 3 take effect from the pixel the FIFO had reached.
+*/
+enum class PpuTiming {
+    Fixed,
+    PixelFifo,
+};
+
 struct Palette {
     Color color0;
     Color color1;
@@ -29,14 +48,48 @@ struct Palette {
 
 class Video {
 public:
-    Video(Gameboy& inGb);
+    // Headless: registers and timing only; no frame buffer is allocated
+    // and nothing is ever drawn
+    Video(Gameboy& inGb, bool inHeadless = false);
+    ~Video();
+
+    // Draws lines on a worker thread as soon as each one is logged,
+    // while the CPU carries on. Frames come out identical; the vblank
+    // callback waits for the last line.
+    void start_render_thread();
+
+    // Called each time we run an instruction, after the Gameboy's clock
+    // has been advanced past it. Instantiated for both timings; call the
+    // one timing() names.
+    template <PpuTiming Timing>
+    void tick();
 
-    // Called each time we run an instruction, passing how many cycles it used
-    void tick(Cycles cycles);
+    void set_timing(PpuTiming timing) { ppu_timing = timing; }
+    PpuTiming timing() const { return ppu_timing; }
+
+    // STAT, LYC and LY writes, which can change the STAT interrupt line
+    void write_stat(u8 value);
+    void write_ly_compare(u8 value);
+    void reset_line();
+
+    // LCD register writes from the MMU, before the register changes.
+    // Only mode 3 writes with PixelFifo timing are of interest.
+    void register_written(u16 address, u8 value) {
+        if (ppu_timing == PpuTiming::PixelFifo && current_mode == VideoMode::ACCESS_VRAM && logging)
+            log_mid_line_write(address, value);
+    }
+
+    // Cycles until the next mode change, i.e. the next time LY, STAT or
+    // the interrupt flags can change
+    uint cycles_until_event() const;
 
     // A callback so your main program can fetch the final frame
     void register_vblank_callback(const vblank_callback_t& cb);
 
+    // Renders one frame, then skips drawing the next `frames`. Modes, LY,
+    // STAT and interrupts run exactly as when every frame is drawn.
+    void set_frame_skip(uint frames);
+
     // For the 0xFF40..0xFF4B registers:
     ByteRegister lcd_control;   // 0xFF40
     ByteRegister lcd_status;    // 0xFF41
@@ -54,14 +107,63 @@ public:
     // Accessor for the final rendered FrameBuffer
     const FrameBuffer& get_framebuffer() const { return buffer; }
 
+    // VRAM writes from the MMU, replayed in order when the frame is drawn
+    void log_write(u16 address, u8 value) {
+        if (logging) vram_writes[lines_logged].push_back({ address, value });
+    }
+
 private:
     void draw();
+    void next_frame();
+
+    /*
+        The STAT interrupt line is the OR of the enabled sources (modes
+        0, 1, 2 and LYC=LY). The interrupt is requested on its rising
+        edge only, so a source that is already holding it high blocks
+        the others ("STAT blocking"). The line is re-evaluated at mode
+        and LY changes, never per instruction.
+    */
+    void update_stat();
+
+    /*
+        Frames are drawn in one pass at VBlank. During the frame each
+        line only records what drawing it depends on: the sprites its
+        OAM scan picked, the registers as of the end of the line, and
+        the VRAM writes made before it. The frame is then replayed over
+        a copy of VRAM taken when it began, either at VBlank or line by
+        line on the render thread.
+    */
+    void begin_frame_log();
+    void log_line();
+    void render_logged_frame();
+    void render_logged_line(uint n);
+
+    // PixelFifo: works out this line's mode 3 from the registers and
+    // the OAM scan, and which pixel a write `dot` dots into it lands on
+    void schedule_mode3();
+    uint pixel_at_dot(uint dot) const;
+    void log_mid_line_write(u16 address, u8 value);
+
+    void render_thread_main();
+    // Hands logged lines to the render thread
+    void publish_lines(uint count);
+    // Waits until the render thread has drawn every published line
+    void finish_rendering();
+    u8 vram_read(u16 address) const { return frame_vram[address - 0x8000]; }
+
     void write_scanline(u8 current_line);
-    void write_sprites();
 
-    void draw_bg_line(uint current_line);
-    void draw_window_line(uint current_line);
-    void draw_sprite(uint sprite_n);
+    // Pixels [x_begin, x_end) of the BG and window
+    void draw_background(uint current_line, uint x_begin, uint x_end);
+    void draw_bg_line(uint current_line, uint x_begin, uint x_end);
+    void draw_window_line(uint current_line, uint x_begin, uint x_end);
+
+    // Mode 2: picks the sprites on the line, as the hardware does at
+    // the end of its OAM scan
+    void evaluate_sprites(uint current_line);
+    void draw_sprites_line(uint current_line);
+    // Merges the BG and sprite line buffers into the frame
+    void composite_line(uint current_line);
 
     // Utility
     bool display_enabled()   const;
@@ -73,7 +175,7 @@ private:
     bool bg_tile_map_display()  const;
     bool window_tile_map()      const;
 
-    Palette load_palette(const ByteRegister& palette_reg);
+    Palette load_palette(u8 palette_reg);
     Color   get_color_from_palette(GBColor color, const Palette& pal);
 
     // Some constants
@@ -84,13 +186,132 @@ private:
     static const uint CLOCKS_PER_HBLANK = 204;
     static const uint CLOCKS_PER_SCANLINE = 456; // sum of above
     static const uint VBLANK_LINES = 10;  // lines 144..153
+    static const uint OAM_SPRITES = 40;
+    static const uint MAX_SPRITES_PER_LINE = 10;
+    static const uint MAX_LINE_WRITES = 32;
+
+    // PixelFifo: dots from the start of mode 3 to the first pixel out
+    // (before fine scroll), and the stalls for the window and sprites
+    static const uint FIFO_LATENCY = 12;
+    static const uint WINDOW_STALL = 6;
+    static const uint SPRITE_STALL = 6;
+    static const uint SPRITE_STALL_MAX = 11;
+
+    // An OAM entry selected for the current line
+    struct LineSprite {
+        u8 y;
+        u8 x;
+        u8 tile;
+        u8 attr;
+        u8 oam_index;
+    };
+
+    struct RegisterWrite {
+        u8 x;       // first pixel drawn with the new value
+        u8 reg;     // address - 0xFF40
+        u8 value;
+    };
+
+    // What drawing a line depends on besides VRAM
+    struct LineState {
+        // Up to 10 sprites, highest priority (lowest X, then OAM order) first
+        std::array<LineSprite, MAX_SPRITES_PER_LINE> sprites;
+        uint sprite_count;
+
+        // Registers as of the end of the line
+        u8 ly;
+        u8 lcdc;
+        u8 scy;
+        u8 scx;
+        u8 wy;
+        u8 wx;
+        u8 bgp;
+        u8 obp0;
+        u8 obp1;
+
+        // PixelFifo: writes to the registers above during mode 3
+        std::array<RegisterWrite, MAX_LINE_WRITES> writes;
+        uint write_count;
+    };
+
+    // The FIFO stops outputting for `dots` once it reaches pixel `x`
+    struct FifoStall {
+        uint x;
+        uint dots;
+    };
+
+    struct VramWrite {
+        u16 address;
+        u8 value;
+    };
+
+    static const uint VRAM_SIZE = 0x2000;
 
     // Data
     Gameboy& gb;
 
     FrameBuffer buffer; // 160144 final
     VideoMode current_mode = VideoMode::ACCESS_OAM;
-    uint cycle_counter = 0;
+    // Clock at which the current mode began; the position within it
+    // is derived from the Gameboy's clock
+    uint64_t mode_start = 0;
+    uint mode_cycles() const;
+    template <PpuTiming Timing>
+    bool advance_mode();
+    PpuTiming ppu_timing = PpuTiming::Fixed;
+    bool stat_line = false;
+
+    // The current line's OAM scan
+    std::array<LineSprite, MAX_SPRITES_PER_LINE> scan_sprites;
+    uint scan_sprite_count = 0;
+
+    // The current line's mode 3 (fixed unless PixelFifo)
+    uint mode3_length = CLOCKS_PER_SCANLINE_VRAM;
+    uint fifo_start = 0;
+    std::array<FifoStall, MAX_SPRITES_PER_LINE + 1> fifo_stalls;
+    uint fifo_stall_count = 0;
+
+    uint frame_skip = 0;
+    uint frames_until_render = 0;
+    bool render_frame = true;
+    bool headless = false;
+
+    std::array<LineState, GAMEBOY_HEIGHT> line_log;
+    uint lines_logged = 0;
+    // Writes made before each line; the last bucket catches writes after
+    // a full frame, which only a write to LY allows
+    std::array<std::vector<VramWrite>, GAMEBOY_HEIGHT + 1> vram_writes;
+    bool logging = false;
+
+    // With the render thread, everything used for drawing below is
+    // owned by it until finish_rendering() returns
+    bool threaded = false;
+    std::thread render_thread;
+    std::mutex render_mutex;
+    std::condition_variable lines_published_cv;
+    std::condition_variable lines_rendered_cv;
+    uint lines_published = 0;   // guarded by render_mutex
+    uint lines_rendered = 0;    // guarded by render_mutex
+    bool render_thread_stop = false;
+
+    // VRAM as of the line being drawn, and that line's state
+    std::vector<u8> frame_vram;
+    LineState line_state = {};
+
+    // BG/window colour index (0..3) of each pixel on the line, before
+    // the palette, which is what sprite priority is decided against;
+    // and the shade it was drawn with
+    std::array<u8, GAMEBOY_WIDTH> bg_line;
+    std::array<u8, GAMEBOY_WIDTH> bg_shade;
+
+    // Sprite pixels for the line, indexed by screen x + 8 so sprites
+    // hanging off either edge need no clipping. The mask is 0xFF where
+    // a sprite pixel won; behind is 0xFF where that sprite has the
+    // behind-BG flag.
+    static const uint SPRITE_LINE_WIDTH = GAMEBOY_WIDTH + 16;
+    std::array<u8, SPRITE_LINE_WIDTH> sprite_shade;
+    std::array<u8, SPRITE_LINE_WIDTH> sprite_mask;
+    std::array<u8, SPRITE_LINE_WIDTH> sprite_behind;
 
     vblank_callback_t vblank_callback;
 };
\ No newline at end of file